@@ -6,14 +6,41 @@
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "signals.h"
 #include <time.h>
 #include <utime.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <climits>
+#include <linux/futex.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
+extern char** environ;
+
 const std::string WHITESPACE = " \n\r\t\f\v";
 const int CMD_MAX_LEN = 80;
 const string BACKGROUND_SYMBOL = "&";
@@ -56,8 +83,15 @@ string _trim(const std::string& s)
 int _parseCommandLine(const char* cmd_line, char** args) {
     FUNC_ENTRY()
     int i = 0;
+    SmallShell& smash = SmallShell::getInstance();
     std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for(std::string s; iss >> s; ) {
+    for(std::string s; i < COMMAND_MAX_ARGS - 1 && iss >> s; ) { //the last slot is kept for the NULL terminator
+        if(s.find('$') != std::string::npos) {
+            s = smash.expandVariables(s);
+            if(s.empty()) { //unset variable expands to nothing, like bash drops the word
+                continue;
+            }
+        }
         args[i] = (char*)malloc(s.length()+1);
         memset(args[i], 0, s.length()+1);
         strcpy(args[i], s.c_str());
@@ -128,11 +162,669 @@ void _removeGivenSign(char* cmd_line, char sign, bool from_start = false) {
     }
 }
 
+//shell style: the exit code, or 128 + the signal that killed or stopped the process
+int _exitStatus(int status){
+    if(WIFEXITED(status)){
+        return WEXITSTATUS(status);
+    }
+    if(WIFSIGNALED(status)){
+        return 128 + WTERMSIG(status);
+    }
+    if(WIFSTOPPED(status)){
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
 bool is_digits(const std::string &str){
     return str.find_first_not_of("-0123456789") == std::string::npos;
 }
 
 
+bool _isValidVarName(const std::string &name){
+    if(name.empty() || isdigit(name[0])){
+        return false;
+    }
+    for(size_t i = 0; i < name.length(); i++){
+        if(!isalnum(name[i]) && name[i] != '_'){
+            return false;
+        }
+    }
+    return true;
+}
+
+//NAME=value with a valid name and nothing else on the line
+bool _isAssignment(const std::string &cmd_s){
+    size_t eq = cmd_s.find('=');
+    if(eq == std::string::npos || cmd_s.find_first_of(WHITESPACE) != std::string::npos){
+        return false;
+    }
+    return _isValidVarName(cmd_s.substr(0, eq));
+}
+
+//drops a trailing "&" (or a & glued to the last word) that the Command constructor left in args
+void _removeBackgroundArg(char** args, int& num_of_args){
+    if(num_of_args < 1){
+        return;
+    }
+    char* last = args[num_of_args - 1];
+    if(strcmp(last, "&") == 0){
+        free(last);
+        args[--num_of_args] = nullptr;
+        return;
+    }
+    _removeBackgroundSign(last);
+}
+
+//write() that keeps going after short writes (pipes, redirected stdout)
+bool _writeAll(int fd, const char* buf, size_t len){
+    while(len > 0){
+        ssize_t written = write(fd, buf, len);
+        if(written == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+/**
+* Read only view of a whole regular file. pages are faulted in lazily, so builtins that only
+* touch the tail or the head of a huge file pay for what they read and not for the file size
+*/
+struct FileView {
+    int fd;
+    const char* data;
+    size_t size;
+    FileView() : fd(-1), data(nullptr), size(0) {}
+};
+
+bool _mapFile(const char* path, FileView& view){
+    view.fd = open(path, O_RDONLY);
+    if(view.fd == -1){
+        perror("smash error: open failed");
+        return false;
+    }
+    struct stat st;
+    if(fstat(view.fd, &st) == -1){
+        perror("smash error: fstat failed");
+        close(view.fd);
+        view.fd = -1;
+        return false;
+    }
+    view.size = st.st_size;
+    if(view.size == 0){ //mmap refuses empty mappings, an empty view is fine
+        return true;
+    }
+    void* addr = mmap(nullptr, view.size, PROT_READ, MAP_PRIVATE, view.fd, 0);
+    if(addr == MAP_FAILED){
+        perror("smash error: mmap failed");
+        close(view.fd);
+        view.fd = -1;
+        return false;
+    }
+    view.data = (const char*)addr;
+    return true;
+}
+
+/**
+* Hands fd to consume one fixed-size chunk at a time, for builtins reading stdin or a file argument.
+* nothing is kept between chunks, and reading stops as soon as consume returns false.
+* files (and a < file on stdin) are read this way and not mapped: these builtins run inside smash,
+* and a file truncated under a mapping raises SIGBUS, which would take the shell down with it
+*/
+bool _readChunks(int fd, std::function<bool(const char*, size_t)> consume){
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    char buf[65536];
+    ssize_t bytes;
+    while((bytes = read(fd, buf, sizeof(buf))) != 0){
+        if(bytes == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("smash error: read failed");
+            return false;
+        }
+        if(!consume(buf, bytes)){
+            return true;
+        }
+    }
+    return true;
+}
+
+void _unmapFile(FileView& view){
+    if(view.data != nullptr && view.fd != -1){
+        munmap(const_cast<char*>(view.data), view.size);
+    }
+    if(view.fd != -1){
+        close(view.fd);
+    }
+    view = FileView();
+}
+
+/**
+* Runs work(0..count-1) in forked workers, at most one per core at a time, and returns the
+* value each one reported. a worker that crashed reports -1
+*/
+vector<long> _runParallel(size_t count, std::function<long(size_t)> work){
+    vector<long> results(count, -1);
+    int fd[2];
+    if(pipe2(fd, O_CLOEXEC) == -1){
+        perror("smash error: pipe failed");
+        return results;
+    }
+    size_t max_workers = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    size_t next = 0;
+    vector<pid_t> running; //only our own workers are reaped, background jobs keep their status
+    while(next < count || !running.empty()){
+        if(next < count && running.size() < max_workers){
+            pid_t pid = fork();
+            if(pid == -1){
+                perror("smash error: fork failed");
+                next++;
+                continue;
+            }
+            if(pid == 0){
+                close(fd[PIPE_READ]);
+                long report[2] = {(long)next, work(next)};
+                _writeAll(fd[PIPE_WRITE], (const char*)report, sizeof(report)); //atomic, it is below PIPE_BUF
+                _exit(0);
+            }
+            next++;
+            running.push_back(pid);
+            continue;
+        }
+        //a worker reports right before it exits, the timeout only matters for one that crashed
+        struct pollfd pfd = {fd[PIPE_READ], POLLIN, 0};
+        if(poll(&pfd, 1, 100) > 0){
+            long report[2];
+            if(read(fd[PIPE_READ], report, sizeof(report)) == sizeof(report)){
+                results[report[0]] = report[1];
+            }
+        }
+        for(size_t i = 0; i < running.size(); ){
+            if(waitpid(running[i], NULL, WNOHANG) != 0){
+                running.erase(running.begin() + i);
+                continue;
+            }
+            i++;
+        }
+    }
+    close(fd[PIPE_WRITE]);
+    long report[2];
+    while(read(fd[PIPE_READ], report, sizeof(report)) == sizeof(report)){
+        results[report[0]] = report[1];
+    }
+    close(fd[PIPE_READ]);
+    return results;
+}
+
+//the rest of the line after its first n words, as typed (not re-tokenized or expanded)
+string _skipWords(const string& line, int n){
+    size_t pos = line.find_first_not_of(WHITESPACE);
+    for(int i = 0; i < n && pos != string::npos; i++){
+        pos = line.find_first_of(WHITESPACE, pos);
+        pos = pos == string::npos ? pos : line.find_first_not_of(WHITESPACE, pos);
+    }
+    return pos == string::npos ? "" : line.substr(pos);
+}
+
+bool _writeFile(const string& path, const string& value){
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if(fd == -1){
+        return false;
+    }
+    bool written = write(fd, value.c_str(), value.length()) == (ssize_t)value.length();
+    close(fd);
+    return written;
+}
+
+//every process whose process group is pgid. a job is the group its first process leads
+vector<pid_t> _processGroupMembers(pid_t pgid){
+    vector<pid_t> members;
+    DIR* proc = opendir("/proc");
+    if(proc == nullptr){
+        members.push_back(pgid);
+        return members;
+    }
+    struct dirent* entry;
+    while((entry = readdir(proc)) != nullptr){
+        if(!isdigit(entry->d_name[0])){
+            continue;
+        }
+        char path[64], buf[512];
+        snprintf(path, sizeof(path), "/proc/%d/stat", atoi(entry->d_name));
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            continue;
+        }
+        ssize_t bytes = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if(bytes <= 0){
+            continue;
+        }
+        buf[bytes] = '\0';
+        //the name field may contain spaces, the fields we want come after its closing paren
+        const char* after_name = strrchr(buf, ')');
+        char state;
+        int ppid, pgrp;
+        if(after_name != nullptr && sscanf(after_name + 1, " %c %d %d", &state, &ppid, &pgrp) == 3 && pgrp == pgid){
+            members.push_back(atoi(entry->d_name));
+        }
+    }
+    closedir(proc);
+    return members;
+}
+
+/***************************************************************************
+****************************************************************************
+******************************JOB_LIMITS************************************
+****************************************************************************
+***************************************************************************/
+
+//smash's own cgroup v2 directory, if /sys/fs/cgroup is cgroup2 and we may create children in it
+string _cgroupBase(){
+    struct statfs fs;
+    if(statfs("/sys/fs/cgroup", &fs) == -1 || fs.f_type != CGROUP2_SUPER_MAGIC){
+        return "";
+    }
+    int fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        return "";
+    }
+    char buf[4096];
+    ssize_t bytes = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(bytes <= 0){
+        return "";
+    }
+    string content(buf, bytes);
+    size_t line = content.find("0::");
+    if(line == string::npos){
+        return "";
+    }
+    string base = "/sys/fs/cgroup" + _trim(content.substr(line + 3, content.find('\n', line) - line - 3));
+    return access(base.c_str(), W_OK) == 0 ? base : "";
+}
+
+/**
+* Creates (or updates) the job's cgroup with memory.max/cpu.max. it only works where the memory
+* and cpu controllers are delegated to smash's cgroup, otherwise the caller falls back to rlimits
+*/
+bool _setupCgroup(JobLimits& limits){
+    static int cgroup_counter = 0;
+    if(limits.mem_bytes == -1 && limits.cpu_percent == -1){
+        return true;
+    }
+    bool created = false;
+    if(limits.cgroup.empty()){
+        string base = _cgroupBase();
+        if(base.empty()){
+            return false;
+        }
+        limits.cgroup = base + "/smash-" + std::to_string(getpid()) + "-" + std::to_string(++cgroup_counter);
+        if(mkdir(limits.cgroup.c_str(), 0755) == -1){
+            limits.cgroup = "";
+            return false;
+        }
+        created = true;
+    }
+    bool ok = true;
+    if(limits.mem_bytes != -1){
+        ok = ok && _writeFile(limits.cgroup + "/memory.max", std::to_string(limits.mem_bytes));
+    }
+    if(limits.cpu_percent != -1){ //quota per 100ms period
+        ok = ok && _writeFile(limits.cgroup + "/cpu.max", std::to_string(limits.cpu_percent * 1000) + " 100000");
+    }
+    if(!ok && created){
+        rmdir(limits.cgroup.c_str());
+        limits.cgroup = "";
+    }
+    return ok;
+}
+
+//the cgroup can only be removed once the job's processes are gone
+void _releaseCgroup(JobLimits& limits){
+    if(!limits.cgroup.empty()){
+        rmdir(limits.cgroup.c_str());
+        limits.cgroup = "";
+    }
+}
+
+//the open files limit smash started with. smash raises its own soft limit so it can hold a pidfd
+//per job even with thousands of jobs, children get the original back before they exec
+static struct rlimit inherited_nofile;
+static bool nofile_raised = false;
+
+void _raiseNofileLimit(){
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == rl.rlim_max){
+        return;
+    }
+    inherited_nofile = rl;
+    rl.rlim_cur = rl.rlim_max;
+    nofile_raised = setrlimit(RLIMIT_NOFILE, &rl) == 0;
+}
+
+void _restoreNofileLimit(){
+    if(nofile_raised){
+        setrlimit(RLIMIT_NOFILE, &inherited_nofile);
+    }
+}
+
+//rlimits through prlimit, pid 0 is the calling process. memory only falls back to RLIMIT_AS without a cgroup
+void _applyRlimits(pid_t pid, const JobLimits& limits){
+    if(limits.nofile != -1){
+        struct rlimit rl = {(rlim_t)limits.nofile, (rlim_t)limits.nofile};
+        if(prlimit(pid, RLIMIT_NOFILE, &rl, nullptr) == -1){
+            perror("smash error: prlimit failed");
+        }
+    }
+    if(limits.mem_bytes != -1 && limits.cgroup.empty()){
+        struct rlimit rl = {(rlim_t)limits.mem_bytes, (rlim_t)limits.mem_bytes};
+        if(prlimit(pid, RLIMIT_AS, &rl, nullptr) == -1){
+            perror("smash error: prlimit failed");
+        }
+    }
+}
+
+//2G, 512M, 64K or plain bytes
+long long _parseSize(const char* str){
+    char* end;
+    long long value = strtoll(str, &end, 10);
+    if(end == str || value < 0){
+        return -1;
+    }
+    switch(toupper(*end)){
+        case 'G': value <<= 30; end++; break;
+        case 'M': value <<= 20; end++; break;
+        case 'K': value <<= 10; end++; break;
+    }
+    return *end == '\0' ? value : -1;
+}
+
+string _formatSize(long long bytes){
+    const char* units[] = {"", "K", "M", "G"};
+    int unit = 0;
+    while(unit < 3 && bytes >= 1024 && bytes % 1024 == 0){
+        bytes /= 1024;
+        unit++;
+    }
+    return std::to_string(bytes) + units[unit];
+}
+
+string _formatLimits(const JobLimits& limits){
+    string str;
+    if(limits.mem_bytes != -1){
+        str += " mem=" + _formatSize(limits.mem_bytes);
+    }
+    if(limits.cpu_percent != -1){
+        str += " cpu=" + std::to_string(limits.cpu_percent) + "%";
+    }
+    if(limits.nofile != -1){
+        str += " nofile=" + std::to_string(limits.nofile);
+    }
+    if(!limits.cgroup.empty()){
+        str += " cgroup=" + limits.cgroup.substr(limits.cgroup.find_last_of('/') + 1);
+    }
+    return str;
+}
+
+/***************************************************************************
+****************************************************************************
+******************************JOB_SCHED*************************************
+****************************************************************************
+***************************************************************************/
+
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_WHO_PROCESS (1)
+#define IOPRIO_WHO_PGRP (2)
+
+/**
+* Applies the attributes to every process of the job's group. nice and io priority have a
+* process group form, the scheduling policy has to be set per process
+*/
+void _applySched(pid_t pgid, const JobSched& sched){
+    if(sched.has_nice && setpriority(PRIO_PGRP, pgid, sched.nice) == -1){
+        perror("smash error: setpriority failed");
+    }
+    if(sched.policy != -1){
+        vector<pid_t> members = _processGroupMembers(pgid);
+        struct sched_param param;
+        param.sched_priority = 0;
+        for(size_t i = 0; i < members.size(); i++){
+            if(sched_setscheduler(members[i], sched.policy, &param) == -1 && errno != ESRCH){
+                perror("smash error: sched_setscheduler failed");
+                break;
+            }
+        }
+    }
+    if(sched.io_class != -1){
+        int ioprio = (sched.io_class << IOPRIO_CLASS_SHIFT) | sched.io_level;
+        if(syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid, ioprio) == -1){
+            perror("smash error: ioprio_set failed");
+        }
+    }
+}
+
+//the same for the calling process only, a job's child sets them on itself before exec. no /proc walk needed
+void _applySchedSelf(const JobSched& sched){
+    if(sched.has_nice && setpriority(PRIO_PROCESS, 0, sched.nice) == -1){
+        perror("smash error: setpriority failed");
+    }
+    struct sched_param param;
+    param.sched_priority = 0;
+    if(sched.policy != -1 && sched_setscheduler(0, sched.policy, &param) == -1){
+        perror("smash error: sched_setscheduler failed");
+    }
+    if(sched.io_class != -1){
+        int ioprio = (sched.io_class << IOPRIO_CLASS_SHIFT) | sched.io_level;
+        if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) == -1){
+            perror("smash error: ioprio_set failed");
+        }
+    }
+}
+
+string _formatSched(const JobSched& sched){
+    string str;
+    if(sched.has_nice){
+        str += " nice=" + std::to_string(sched.nice);
+    }
+    if(sched.policy != -1){
+        str += string(" policy=") + (sched.policy == SCHED_BATCH ? "batch" : sched.policy == SCHED_IDLE ? "idle" : "other");
+    }
+    if(sched.io_class == 3){
+        str += " io=idle";
+    }
+    else if(sched.io_class != -1){
+        str += string(" io=") + (sched.io_class == 1 ? "rt:" : "be:") + std::to_string(sched.io_level);
+    }
+    return str;
+}
+
+/**
+* Opens the target of > (truncate) or >> (append) with the flags and mode RedirectionCommand uses.
+* splice() refuses O_APPEND files, so for_splice opens >> targets positioned at EOF instead
+*/
+int _openRedirectTarget(const char* path, bool append, bool for_splice = false){
+    int flags = O_WRONLY | O_CREAT | (append ? (for_splice ? 0 : O_APPEND) : O_TRUNC);
+    int fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+    if(fd != -1 && append && for_splice){
+        lseek(fd, 0, SEEK_END);
+    }
+    return fd;
+}
+
+/**
+* fork() whose child is handed to init right away (double fork), for helpers that outlive the
+* command that started them and that nobody waits for. returns 0 in the helper, the pid of the
+* short lived middle process in the caller and -1 on error. the helper gets its own process group
+* so ctrl-C/ctrl-Z on the terminal doesn't reach it
+*/
+pid_t _forkDetached(){
+    pid_t middle = fork();
+    if(middle == -1){
+        perror("smash error: fork failed");
+        return -1;
+    }
+    if(middle == 0){
+        pid_t helper = fork();
+        if(helper != 0){
+            _exit(helper == -1 ? 1 : 0);
+        }
+        setpgrp();
+        return 0;
+    }
+    int status;
+    waitpid(middle, &status, 0);
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? middle : -1;
+}
+
+/***************************************************************************
+****************************************************************************
+******************************JOB_OUTPUT************************************
+****************************************************************************
+***************************************************************************/
+
+#define RING_HEADER_SIZE (64)
+
+//start of the shared mapping. written counts every byte ever drained, so byte n sits at n % capacity
+struct RingHeader {
+    std::atomic<unsigned long long> written;
+    std::atomic<int> seq; //bumped on every update, followers futex-wait on it
+    std::atomic<int> done; //the job and everything that shared its stdout closed the pipe
+};
+
+static long _futex(std::atomic<int>* addr, int op, int val, const struct timespec* timeout){
+    return syscall(SYS_futex, reinterpret_cast<int*>(addr), op, val, timeout, nullptr, 0);
+}
+
+//copies everything that comes out of in into the ring, in the detached reader
+static void _drainIntoRing(int in, char* ring, size_t capacity){
+    RingHeader* header = reinterpret_cast<RingHeader*>(ring);
+    char* data = ring + RING_HEADER_SIZE;
+    char buf[65536];
+    ssize_t bytes;
+    while((bytes = read(in, buf, sizeof(buf))) != 0){
+        if(bytes == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        unsigned long long total = header->written.load(std::memory_order_relaxed) + bytes;
+        size_t keep = min((size_t)bytes, capacity); //a ring smaller than one read keeps its tail
+        size_t pos = (total - keep) % capacity;
+        size_t first = min(keep, capacity - pos);
+        memcpy(data + pos, buf + bytes - keep, first);
+        memcpy(data, buf + bytes - keep + first, keep - first);
+        header->written.store(total, std::memory_order_release);
+        header->seq.fetch_add(1, std::memory_order_release);
+        _futex(&header->seq, FUTEX_WAKE, INT_MAX, nullptr);
+    }
+    header->done.store(1, std::memory_order_release);
+    header->seq.fetch_add(1, std::memory_order_release);
+    _futex(&header->seq, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+/**
+* Creates the ring and the reader that fills it. the job gets output.writer as stdout/stderr,
+* a detached reader drains the other end into the memfd, so smash never has to read job output
+* and nothing touches the filesystem
+*/
+bool _setupOutput(JobOutput& output){
+    output.memfd = memfd_create("smash-job-output", MFD_CLOEXEC);
+    if(output.memfd == -1){
+        perror("smash error: memfd_create failed");
+        return false;
+    }
+    size_t length = RING_HEADER_SIZE + output.capacity;
+    if(ftruncate(output.memfd, length) == -1){
+        perror("smash error: ftruncate failed");
+        close(output.memfd);
+        output.memfd = -1;
+        return false;
+    }
+    void* addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, output.memfd, 0);
+    if(addr == MAP_FAILED){
+        perror("smash error: mmap failed");
+        close(output.memfd);
+        output.memfd = -1;
+        return false;
+    }
+    output.ring = (char*)addr; //a fresh memfd reads as zeros, which is an empty ring
+    int fd[2];
+    if(pipe2(fd, O_CLOEXEC) == -1){
+        perror("smash error: pipe failed");
+        return false;
+    }
+    pid_t reader = _forkDetached();
+    if(reader == 0){
+        close(fd[PIPE_WRITE]);
+        _drainIntoRing(fd[PIPE_READ], output.ring, output.capacity);
+        _exit(0);
+    }
+    close(fd[PIPE_READ]);
+    if(reader == -1){
+        close(fd[PIPE_WRITE]);
+        return false;
+    }
+    output.writer = fd[PIPE_WRITE];
+    return true;
+}
+
+//the parent's copy of the write end, closed once the job is forked so the reader sees EOF when the job ends
+void _closeOutputWriter(JobOutput& output){
+    if(output.writer != -1){
+        close(output.writer);
+        output.writer = -1;
+    }
+}
+
+void _releaseOutput(JobOutput& output){
+    _closeOutputWriter(output);
+    if(output.ring != nullptr){
+        munmap(output.ring, RING_HEADER_SIZE + output.capacity);
+    }
+    if(output.memfd != -1){
+        close(output.memfd);
+    }
+    output = JobOutput();
+}
+
+/**
+* Copies ring bytes [from, to) into out. bytes the reader overwrote while we copied are dropped
+* from the front, returns the offset out really starts at
+*/
+unsigned long long _readRing(const JobOutput& output, unsigned long long from, unsigned long long to, string& out){
+    const RingHeader* header = reinterpret_cast<const RingHeader*>(output.ring);
+    const char* data = output.ring + RING_HEADER_SIZE;
+    if(to > output.capacity && to - output.capacity > from){
+        from = to - output.capacity;
+    }
+    out.clear();
+    for(unsigned long long i = from; i < to; ){
+        size_t pos = i % output.capacity;
+        size_t chunk = min((unsigned long long)(output.capacity - pos), to - i);
+        out.append(data + pos, chunk);
+        i += chunk;
+    }
+    unsigned long long now = header->written.load(std::memory_order_acquire);
+    if(now > output.capacity && now - output.capacity > from){
+        size_t lost = min((unsigned long long)out.size(), now - output.capacity - from);
+        out.erase(0, lost);
+        from += lost;
+    }
+    return from;
+}
+
 bool is_complex_command(char* cmd_line){
     for(int i=0; i<strlen(cmd_line); i++){
         if(cmd_line[i] == '?' || cmd_line[i] == '*'){
@@ -148,20 +840,25 @@ bool is_complex_command(char* cmd_line){
 ****************************************************************************
 ***************************************************************************/
 
-Command::Command(const char* original_cmd_line, bool ignore_ampersand, int pid) : orig_cmd_line(original_cmd_line), is_in_bg(false), child_pid(-1) {
+Command::Command(const char* original_cmd_line, bool ignore_ampersand, int pid) : orig_cmd_line(original_cmd_line), is_in_bg(false), job_state(FOREGROUND), child_pid(-1) {
     SmallShell& smash = SmallShell::getInstance();
     cmd_line = new char[strlen(original_cmd_line)+1];
     strcpy(cmd_line, original_cmd_line);
+    for (int i = 0; i < COMMAND_MAX_ARGS; i++) { //the destructor frees every non null slot
+        args[i] = nullptr;
+    }
     num_of_args = _parseCommandLine(cmd_line, args);
     if(ignore_ampersand) {
         _removeBackgroundSign(args[0]);
         if (num_of_args > 1) {
             _removeBackgroundSign(args[1]);
             if (*args[1] == ' ') {
+                free(args[1]);
                 for (int i = 1; i < num_of_args - 1; i++) {
                     args[i] = args[i + 1];
                 }
                 num_of_args--;
+                args[num_of_args] = nullptr; //moved down, don't leave a second owner of the pointer
             }
         }
     }
@@ -171,6 +868,8 @@ BuiltInCommand::BuiltInCommand(const char* cmd_line, int pid) :
         Command(cmd_line, true, pid) {}
 
 Command::~Command(){
+    _releaseCgroup(limits);
+    _releaseOutput(output);
     delete[] cmd_line;
     for (int i = 0; i < COMMAND_MAX_ARGS; i++) {
         if (args[i] != nullptr) {
@@ -183,6 +882,85 @@ char* Command::getCmdLine() {
     return cmd_line;
 }
 
+void Command::prepareChild() {
+    if(session_socket != -1) { //a job outliving the session must not keep the client's connection open
+        close(session_socket);
+        session_socket = -1;
+    }
+    _restoreNofileLimit();
+    if(!limits.cgroup.empty()) {
+        _writeFile(limits.cgroup + "/cgroup.procs", "0"); //0 is the writing process itself
+    }
+    _applyRlimits(0, limits);
+    if(sched.any()) {
+        _applySchedSelf(sched);
+    }
+    if(output.writer != -1) {
+        dup2(output.writer, STDOUT);
+        dup2(output.writer, STDERR);
+        close(output.writer);
+    }
+}
+
+//hands what a limit/sched builtin asked for over to the command it launches
+void _takePendingAttrs(Command* cmd){
+    SmallShell& smash = SmallShell::getInstance();
+    if(smash.pending_sched != nullptr) {
+        cmd->sched = *smash.pending_sched;
+        smash.pending_sched = nullptr;
+    }
+    if(smash.pending_output != nullptr) {
+        cmd->output.capacity = smash.pending_output->capacity;
+        smash.pending_output = nullptr;
+        if(!_setupOutput(cmd->output)) {
+            _releaseOutput(cmd->output);
+        }
+    }
+    if(smash.pending_limits == nullptr) {
+        return;
+    }
+    cmd->limits = *smash.pending_limits;
+    smash.pending_limits = nullptr;
+    if(!_setupCgroup(cmd->limits) && cmd->limits.cpu_percent != -1) {
+        cerr << "smash error: limit: no writable cgroup v2 with the cpu controller, --cpu ignored" << endl;
+        cmd->limits.cpu_percent = -1;
+    }
+}
+
+void Command::launchForked() {
+    SmallShell& smash = SmallShell::getInstance();
+    _takePendingAttrs(this);
+    pid_t child = fork();
+    if(child != 0) {
+        _closeOutputWriter(output); //only the job writes into the capture pipe
+    }
+    if(child == -1) {
+        perror("smash error: fork failed");
+        return;
+    }
+    if(child == 0) {
+        setpgrp();
+        prepareChild();
+        childMain();
+        exit(smash.last_status); //an error in the child is the job's status
+    }
+    pid = child;
+    if(is_in_bg) {
+        job_state = BACKGROUND;
+        return;
+    }
+    smash.fg_cmd = this;
+    int status = 0;
+    if(waitpid(child, &status, WUNTRACED) == -1) {
+        perror("smash error: waitpid failed");
+    }
+    smash.fg_cmd = nullptr;
+    smash.last_status = _exitStatus(status);
+    if(WIFSTOPPED(status)) {
+        job_state = STOPPED;
+    }
+}
+
 /***************************************************************************
 ****************************************************************************
 ***************************CHPROMPT_COMMAND*********************************
@@ -220,18 +998,147 @@ void ChpromptCommand::execute() {
 ****************************************************************************
 ***************************************************************************/
 
-SmallShell::SmallShell() : prompt(DEFAULT_PROMPT), is_prompt_changed(false), prev_path(nullptr), fg_cmd(nullptr), fg_cmd_job_id(-1) {
+SmallShell::SmallShell() : prompt(DEFAULT_PROMPT), is_prompt_changed(false), prev_path(nullptr), envp_dirty(true), record_fd(-1), exec_depth(0), fg_cmd(nullptr), fg_cmd_job_id(-1), pending_limits(nullptr), pending_sched(nullptr), pending_output(nullptr), interrupted(0), last_status(0) {
     Jobs_List = new JobsList();
+    _raiseNofileLimit();
+    //everything smash inherited is exported to the children
+    for(char** env = environ; env && *env; env++){
+        string entry(*env);
+        size_t eq = entry.find('=');
+        if(eq == string::npos){
+            continue;
+        }
+        variables[entry.substr(0, eq)] = entry.substr(eq + 1);
+        exported.insert(entry.substr(0, eq));
+    }
 }
 
-
-void SmallShell::setPrompt(std::string new_prompt) {
-    SmallShell& smash = SmallShell::getInstance();
-    smash.prompt = new_prompt;
+bool SmallShell::getVariable(const std::string& name, std::string& value) {
+    map<string, string>::iterator iter = variables.find(name);
+    if(iter == variables.end()){
+        return false;
+    }
+    value = iter->second;
+    return true;
 }
 
-string SmallShell::getPrompt() {
-    return prompt;
+void SmallShell::setVariable(const std::string& name, const std::string& value) {
+    variables[name] = value;
+    if(exported.count(name)){
+        envp_dirty = true;
+        if(name == "PATH"){ //execvpe searches the PATH of smash itself
+            setenv("PATH", value.c_str(), 1);
+        }
+    }
+}
+
+void SmallShell::exportVariable(const std::string& name) {
+    if(exported.insert(name).second && variables.count(name)){
+        envp_dirty = true;
+    }
+    if(name == "PATH" && variables.count(name)){
+        setenv("PATH", variables[name].c_str(), 1);
+    }
+}
+
+void SmallShell::unsetVariable(const std::string& name) {
+    if(exported.erase(name) && variables.count(name)){
+        envp_dirty = true;
+    }
+    variables.erase(name);
+    if(name == "PATH"){
+        unsetenv("PATH");
+    }
+}
+
+map<string, string> SmallShell::getExportedVariables() {
+    map<string, string> result;
+    for(set<string>::iterator iter = exported.begin(); iter != exported.end(); iter++){
+        map<string, string>::iterator var = variables.find(*iter);
+        if(var != variables.end()){
+            result[var->first] = var->second;
+        }
+    }
+    return result;
+}
+
+/**
+* Expands $NAME, ${NAME} and $$ inside a single word. unknown variables expand to ""
+*/
+string SmallShell::expandVariables(const std::string& word) {
+    string result;
+    size_t i = 0;
+    while(i < word.length()){
+        if(word[i] != '$' || i + 1 == word.length()){
+            result += word[i++];
+            continue;
+        }
+        string name;
+        if(word[i + 1] == '$'){
+            result += std::to_string(getpid());
+            i += 2;
+            continue;
+        }
+        if(word[i + 1] == '{'){
+            size_t close = word.find('}', i + 2);
+            if(close == string::npos){ //no closing brace, keep it literally
+                result += word.substr(i);
+                break;
+            }
+            name = word.substr(i + 2, close - i - 2);
+            i = close + 1;
+        }
+        else{
+            size_t end = i + 1;
+            while(end < word.length() && (isalnum(word[end]) || word[end] == '_')){
+                end++;
+            }
+            if(end == i + 1){ //a lonely $ stays as is
+                result += word[i++];
+                continue;
+            }
+            name = word.substr(i + 1, end - i - 1);
+            i = end;
+        }
+        string value;
+        if(getVariable(name, value)){
+            result += value;
+        }
+    }
+    return result;
+}
+
+/**
+* Returns the envp block for execve. it is only re-serialized after an exported variable changed,
+* so a spawn normally just passes the same ready pointer
+*/
+char** SmallShell::getEnvp() {
+    if(envp_dirty){
+        envp_strings.clear();
+        envp_block.clear();
+        for(set<string>::iterator iter = exported.begin(); iter != exported.end(); iter++){
+            map<string, string>::iterator var = variables.find(*iter);
+            if(var != variables.end()){
+                envp_strings.push_back(var->first + "=" + var->second);
+            }
+        }
+        for(size_t i = 0; i < envp_strings.size(); i++){
+            envp_block.push_back(const_cast<char*>(envp_strings[i].c_str()));
+        }
+        envp_block.push_back(nullptr);
+        envp_dirty = false;
+    }
+    return envp_block.data();
+}
+
+
+void SmallShell::setPrompt(std::string new_prompt) {
+    SmallShell& smash = SmallShell::getInstance();
+    smash.prompt = new_prompt;
+}
+
+string SmallShell::getPrompt() {
+    return prompt;
 }
 
 
@@ -250,6 +1157,20 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
     JobsList* jobs = smash.Jobs_List;
     string cmd_s = _trim(string(cmd_line));
     string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+    if(_isAssignment(cmd_s)) {
+        return new AssignmentCommand(cmd_line, -1);
+    }
+    size_t less = cmd_s.find('<');
+    size_t heredoc = cmd_s.find("<<");
+    if(less != std::string::npos && (less < cmd_s.find('|') || (heredoc != std::string::npos && cmd_s.compare(heredoc, 3, "<<<") != 0))) {
+        return new InputRedirectionCommand(cmd_line, -1); //< of a later pipe stage is handled in that stage, << is read here
+    }
+    if(cmd_s.find("|>") != std::string::npos) { //fan-out, the > words belong to the tee stage
+        return new PipeCommand(cmd_line, -1);
+    }
+    if(firstWord.compare("tee") == 0 && cmd_s.find("|") == std::string::npos) { //tee takes its own > and >> targets
+        return new TeeCommand(cmd_line, -1);
+    }
     if(cmd_s.find(">") != std::string::npos) {
         return new RedirectionCommand(cmd_line, -1);
     }
@@ -286,12 +1207,63 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
     else if(firstWord.compare("setcore") == 0 || firstWord.compare("setcore&") == 0) {
         return new SetcoreCommand(cmd_line, -1);
     }
-//    else if(firstWord.compare("tail") == 0) {
-//        return new TailCommand(cmd_line);
-//    }
-//    else if(firstWord.compare("touch") == 0) {
-//        return new TouchCommand(cmd_line);
-//    }
+    else if(firstWord.compare("pmap") == 0) {
+        return new PmapCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("sched") == 0) {
+        return new SchedCommand(cmd_line, jobs, -1);
+    }
+    else if(firstWord.compare("limit") == 0) {
+        return new LimitCommand(cmd_line, jobs, -1);
+    }
+    else if(firstWord.compare("capture") == 0) {
+        return new CaptureCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("output") == 0 || firstWord.compare("output&") == 0) {
+        return new OutputCommand(cmd_line, jobs, -1);
+    }
+    else if(firstWord.compare("fare") == 0 || firstWord.compare("fare&") == 0) {
+        return new FareCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("export") == 0 || firstWord.compare("export&") == 0) {
+        return new ExportCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("unset") == 0 || firstWord.compare("unset&") == 0) {
+        return new UnsetCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("tail") == 0 || firstWord.compare("tail&") == 0) {
+        return new TailCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("after") == 0) {
+        return new AfterCommand(cmd_line, jobs, -1);
+    }
+    else if(firstWord.compare("watch") == 0) {
+        return new WatchCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("touch") == 0 || firstWord.compare("touch&") == 0) {
+        return new TouchCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("cat") == 0 || firstWord.compare("cat&") == 0) {
+        return new CatCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("head") == 0 || firstWord.compare("head&") == 0) {
+        return new HeadCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("cp") == 0 || firstWord.compare("cp&") == 0) {
+        return new CpCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("wc") == 0 || firstWord.compare("wc&") == 0) {
+        return new WcCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("wait") == 0 || firstWord.compare("wait&") == 0) {
+        return new WaitCommand(cmd_line, Jobs_List, -1);
+    }
+    else if(firstWord.compare("xargs") == 0 || firstWord.compare("xargs&") == 0) {
+        return new XargsCommand(cmd_line, -1);
+    }
+    else if(firstWord.compare("jobstat") == 0 || firstWord.compare("jobstat&") == 0) {
+        return new JobStatCommand(cmd_line, Jobs_List, -1);
+    }
 //    else if(firstWord.compare("timeout") == 0) {
 //        return new TimeoutCommand(cmd_line);
 //    }
@@ -303,11 +1275,326 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
 }
 
 
+/**
+* Called at an interactive prompt. while pending jobs exist, waits on the terminal and on the pidfds
+* of running jobs together, so a finished dependency starts the next step right away even if
+* nobody types anything
+*/
+void SmallShell::waitForInput() {
+    while(Jobs_List->hasPending()) {
+        vector<struct pollfd> fds(1);
+        fds[0].fd = STDIN;
+        fds[0].events = POLLIN;
+        vector<JobsList::JobEntry>* job_list = Jobs_List->getJobsList();
+        for(vector<JobsList::JobEntry>::iterator iter = job_list->begin(); iter != job_list->end(); iter++) {
+            if(iter->state != PENDING && iter->pidfd.get() != -1) {
+                struct pollfd pfd = {iter->pidfd.get(), POLLIN, 0}; //readable once the process exited
+                fds.push_back(pfd);
+            }
+        }
+        if(poll(fds.data(), fds.size(), -1) == -1 && errno != EINTR) {
+            return;
+        }
+        if(fds[0].revents != 0) {
+            return;
+        }
+        Jobs_List->removeFinishedJobs();
+        cout << flush;
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************LISTS**************************************
+****************************************************************************
+***************************************************************************/
+
+//one ; or & separated part of a line: its && / || steps
+struct CommandList {
+    vector<string> steps;
+    vector<bool> and_ops;
+    bool background;
+    string text; //the part itself, with its & if it had one
+    CommandList() : background(false) {}
+};
+
+/**
+* Splits a line on its ; and & terminators and the && / || inside each part, in one pass. quoted
+* text is never split. a lone & ends a part that goes to the background, |& and |> stay pipes.
+* false (after printing why) when an && or || has nothing on one of its sides
+*/
+bool _parseCommandLists(const string& line, vector<CommandList>& lists){
+    CommandList current;
+    size_t step_start = 0, part_start = 0;
+    char quote = 0;
+    auto end_step = [&](size_t end, const char* op) -> bool {
+        string step = _trim(line.substr(step_start, end - step_start));
+        if(step.empty() && (op != nullptr || !current.steps.empty())){
+            cerr << "smash error: syntax error near '" << (op != nullptr ? op : (current.and_ops.back() ? "&&" : "||")) << "'" << endl;
+            return false;
+        }
+        if(!step.empty()){
+            current.steps.push_back(step);
+        }
+        return true;
+    };
+    auto end_part = [&](size_t end, bool background) -> bool {
+        if(!end_step(end, nullptr)){
+            return false;
+        }
+        if(!current.steps.empty()){
+            current.text = _trim(line.substr(part_start, end - part_start)) + (background ? " &" : "");
+            current.background = background;
+            lists.push_back(current);
+        }
+        current = CommandList();
+        return true;
+    };
+    for(size_t i = 0; i < line.size(); i++){
+        char c = line[i];
+        if(quote != 0){
+            quote = c == quote ? 0 : quote;
+            continue;
+        }
+        if(c == '\'' || c == '"'){
+            quote = c;
+        }
+        else if((c == '&' || c == '|') && i + 1 < line.size() && line[i + 1] == c){
+            if(!end_step(i, c == '&' ? "&&" : "||")){
+                return false;
+            }
+            current.and_ops.push_back(c == '&');
+            step_start = ++i + 1;
+        }
+        else if(c == '|' && i + 1 < line.size() && (line[i + 1] == '&' || line[i + 1] == '>')){
+            i++;
+        }
+        else if(c == ';' || (c == '&' && line.find_first_not_of(WHITESPACE, i + 1) != string::npos)){
+            if(!end_part(i, c == '&')){
+                return false;
+            }
+            step_start = part_start = i + 1;
+        }
+    }
+    string last = _trim(line.substr(part_start));
+    bool background = !last.empty() && last.back() == '&' && (last.size() < 2 || last[last.size() - 2] != '|');
+    if(!end_part(background ? line.find_last_of('&') : line.size(), background)){
+        return false;
+    }
+    return true;
+}
+
+ListCommand::ListCommand(const char* cmd_line, const vector<string>& steps, const vector<bool>& and_ops, int pid):
+        BuiltInCommand(cmd_line, pid), steps(steps), and_ops(and_ops) {
+    is_in_bg = _isBackgroundCommand(cmd_line);
+}
+
+void ListCommand::execute(){
+    if(is_in_bg){ //the list as a whole is the job
+        launchForked();
+        return;
+    }
+    runSteps();
+}
+
+void ListCommand::childMain(){
+    runSteps();
+    cout.flush();
+    exit(SmallShell::getInstance().last_status);
+}
+
+void ListCommand::runSteps(){
+    SmallShell& smash = SmallShell::getInstance();
+    for(size_t i = 0; i < steps.size() && !smash.interrupted; i++){
+        if(i > 0 && and_ops[i - 1] != (smash.last_status == 0)){ //skipped, the status stays for the next operator
+            continue;
+        }
+        smash.Jobs_List->removeFinishedJobs();
+        smash.runCommand(steps[i].c_str());
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+********************************RECORD**************************************
+****************************************************************************
+***************************************************************************/
+
+//a --record file is the magic, then a RecordEntry per command followed by its command line
+static const char RECORD_MAGIC[8] = {'S', 'M', 'A', 'S', 'H', 'R', 'C', '2'};
+
+struct RecordEntry {
+    uint64_t start_ns; //wall clock, for reading the file
+    uint64_t offset_ns; //monotonic, since recording started. timed replay goes by this one
+    uint64_t duration_ns;
+    int32_t status;
+    uint32_t length;
+};
+
+static uint64_t _nanoseconds(const struct timespec& ts){
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t record_base_ns = 0; //CLOCK_MONOTONIC when --record started
+
+//one write per command, a session cut short by a crash or quit keeps every command before it
+static void _recordCommand(int fd, const char* cmd_line, uint64_t start_ns, uint64_t mono_start_ns, uint64_t duration_ns, int status){
+    RecordEntry entry = {start_ns, mono_start_ns - record_base_ns, duration_ns, status, (uint32_t)strlen(cmd_line)};
+    string buf((const char*)&entry, sizeof(entry));
+    buf.append(cmd_line, entry.length);
+    if(!_writeAll(fd, buf.data(), buf.size())){
+        perror("smash error: write failed");
+    }
+}
+
+bool SmallShell::startRecording(const char* path){
+    record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(record_fd == -1){
+        perror("smash error: open failed");
+        return false;
+    }
+    if(!_writeAll(record_fd, RECORD_MAGIC, sizeof(RECORD_MAGIC))){
+        perror("smash error: write failed");
+        close(record_fd);
+        record_fd = -1;
+        return false;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record_base_ns = _nanoseconds(now);
+    return true;
+}
+
+struct ReplayResult {
+    string cmd_line;
+    uint64_t then_ns;
+    uint64_t now_ns;
+    int then_status;
+    int now_status;
+};
+
+/**
+* Reruns every command of a --record file through executeCommand, back to back or, when timed,
+* each one at the same offset from the session start as it had originally (a command that runs late
+* doesn't delay the ones after it any further). then prints how long each one took then and now
+*/
+void SmallShell::replaySession(const char* path, bool timed){
+    FileView view;
+    if(!_mapFile(path, view)){
+        return;
+    }
+    fcntl(view.fd, F_SETFD, FD_CLOEXEC);
+    if(view.size < sizeof(RECORD_MAGIC) || memcmp(view.data, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0){
+        cerr << "smash error: replay: " << path << " is not a session recording" << endl;
+        _unmapFile(view);
+        return;
+    }
+    vector<ReplayResult> results;
+    struct timespec base;
+    clock_gettime(CLOCK_MONOTONIC, &base);
+    uint64_t first_start = 0;
+    size_t pos = sizeof(RECORD_MAGIC);
+    while(pos + sizeof(RecordEntry) <= view.size){
+        RecordEntry entry;
+        memcpy(&entry, view.data + pos, sizeof(entry));
+        pos += sizeof(entry);
+        if(entry.length > view.size - pos){
+            cerr << "smash error: replay: " << path << " is truncated" << endl;
+            break;
+        }
+        string cmd_line(view.data + pos, entry.length);
+        pos += entry.length;
+        if(results.empty()){
+            first_start = entry.offset_ns;
+        }
+        if(timed && entry.offset_ns >= first_start){ //a damaged file can't make it sleep for ages the other way
+            uint64_t at = _nanoseconds(base) + (entry.offset_ns - first_start);
+            struct timespec wake = {(time_t)(at / 1000000000ULL), (long)(at % 1000000000ULL)};
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr) == EINTR){}
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        executeCommand(cmd_line.c_str());
+        cout.flush();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ReplayResult result = {cmd_line, entry.duration_ns, _nanoseconds(end) - _nanoseconds(start), entry.status, last_status};
+        results.push_back(result);
+    }
+    _unmapFile(view);
+    uint64_t then_total = 0, now_total = 0;
+    for(auto& result : results){
+        then_total += result.then_ns;
+        now_total += result.now_ns;
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf), "smash: replay: %zu commands, %.3fs recorded, %.3fs now\n%10s %10s %8s %7s  %s\n",
+             results.size(), then_total / 1e9, now_total / 1e9, "then ms", "now ms", "delta", "status", "command");
+    string report = buf;
+    for(auto& result : results){
+        string status = std::to_string(result.now_status);
+        if(result.now_status != result.then_status){
+            status = std::to_string(result.then_status) + "->" + status;
+        }
+        double delta = result.then_ns == 0 ? 0 : ((double)result.now_ns - result.then_ns) * 100 / result.then_ns;
+        snprintf(buf, sizeof(buf), "%10.3f %10.3f %+7.1f%% %7s  ", result.then_ns / 1e6, result.now_ns / 1e6, delta, status.c_str());
+        report += buf + result.cmd_line + "\n";
+    }
+    cerr << report;
+}
+
+/**
+* One line of input. it is parsed once here into its ; and & separated parts and their && / ||
+* steps, then each part runs as if it had a line of its own. ctrl-C stops the rest of the line
+*/
 void SmallShell::executeCommand(const char *cmd_line) {
 	this->Jobs_List->removeFinishedJobs();
-    Command* cmd = CreateCommand(cmd_line);
+    if(_trim(string(cmd_line)).empty()) {
+        return;
+    }
+    vector<CommandList> lists;
+    if(!_parseCommandLists(cmd_line, lists)) {
+        last_status = 2;
+        return;
+    }
+    bool recorded = record_fd != -1 && exec_depth == 0;
+    struct timespec wall_start, start, end;
+    clock_gettime(CLOCK_REALTIME, &wall_start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(exec_depth == 0) {
+        interrupted = 0;
+    }
+    exec_depth++;
+    for(size_t i = 0; i < lists.size() && !interrupted; i++) {
+        if(lists[i].steps.size() == 1) {
+            runCommand(lists.size() == 1 ? cmd_line : lists[i].text.c_str());
+        }
+        else {
+            runCommand(lists[i].text.c_str(), new ListCommand(lists[i].text.c_str(), lists[i].steps, lists[i].and_ops, -1));
+        }
+    }
+    exec_depth--;
+    if(recorded) {
+        cout.flush(); //the output belongs to the command's time
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        _recordCommand(record_fd, cmd_line, _nanoseconds(wall_start), _nanoseconds(start), _nanoseconds(end) - _nanoseconds(start), last_status);
+    }
+}
+
+/**
+* Runs a single command (or the ListCommand given for it) and sets last_status. a builtin that
+* reports an error sets it to 1 itself
+*/
+void SmallShell::runCommand(const char* cmd_line, Command* list_cmd) {
+    last_status = 0;
+    std::unique_ptr<Command> cmd(list_cmd != nullptr ? list_cmd : CreateCommand(cmd_line));
     cmd->execute();
     // Please note that you must fork smash process for some commands (e.g., external commands....)
+    //a command that left a process behind (background or stopped) is handed to the jobs list,
+    //everything else is freed here
+    if(cmd->job_state != FOREGROUND) {
+        Job_State state = cmd->job_state;
+        Jobs_List->addJob(std::move(cmd), state, -1);
+    }
 }
 
 /***************************************************************************
@@ -316,8 +1603,8 @@ void SmallShell::executeCommand(const char *cmd_line) {
 ****************************************************************************
 ***************************************************************************/
 
-JobsList::JobEntry::JobEntry(int process_id, int job_id, Command* cmd, Job_State state) : process_id(process_id),
-                                                                                          job_id(job_id), cmd(cmd), state(state), start_time(time(NULL)){
+JobsList::JobEntry::JobEntry(int process_id, int job_id, std::unique_ptr<Command> cmd, Job_State state) : process_id(process_id),
+                                                                                          job_id(job_id), cmd(std::move(cmd)), state(state), start_time(time(NULL)), pidfd(process_id), needs_success(false), scheduled(false){
 //    time_t p_time;
 //    if(time(&p_time) < 0 ) {
 //        perror("smash error: time failed");
@@ -326,83 +1613,146 @@ JobsList::JobEntry::JobEntry(int process_id, int job_id, Command* cmd, Job_State
 //    start_time = p_time;
 }
 
-void JobsList::printJobsList(){
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1 << 2)
+#endif
+
+PidFd::PidFd(pid_t pid) : fd(pid > 0 ? syscall(SYS_pidfd_open, pid, 0) : -1) {} //-1 on old kernels, signal() falls back to kill()
+
+PidFd& PidFd::operator=(PidFd&& other) {
+    if(this != &other) {
+        if(fd != -1) {
+            close(fd);
+        }
+        fd = other.fd;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+PidFd::~PidFd() {
+    if(fd != -1) {
+        close(fd);
+    }
+}
+
+bool JobsList::JobEntry::signal(int sig, bool group){
+    if(state == PENDING){ //no process yet, and kill(-1) would hit everything we may signal
+        errno = ESRCH;
+        return false;
+    }
+    if(pidfd.get() == -1){
+        return kill(group ? -process_id : process_id, sig) == 0;
+    }
+    if(syscall(SYS_pidfd_send_signal, pidfd.get(), sig, nullptr, group ? PIDFD_SIGNAL_PROCESS_GROUP : 0) == 0){
+        return true;
+    }
+    if(group && errno == EINVAL){ //kernel without group signalling on pidfds. the pidfd still tells us the leader is ours
+        return syscall(SYS_pidfd_send_signal, pidfd.get(), 0, nullptr, 0) == 0 && kill(-process_id, sig) == 0;
+    }
+    return false;
+}
+
+void JobsList::printJobsList(bool verbose){
     SmallShell& smash = SmallShell::getInstance();
     vector<JobsList::JobEntry>* job_list = smash.Jobs_List->getJobsList();
     vector<JobsList::JobEntry>::iterator iter;
     smash.Jobs_List->removeFinishedJobs();
 
+    //captured jobs that ended are reported once, in id order with the rest, and their output is dropped
+    map<int, std::unique_ptr<Command>>::iterator done = finished_captured.begin();
+    auto printDone = [&](int below){
+        for(; done != finished_captured.end() && done->first < below; done++){
+            cout << "[" << done->first << "] " << done->second->cmd_line << " : done (captured)\n";
+        }
+    };
     for(iter = job_list->begin();iter < job_list->end() ;iter++){
-        cout << "[" << iter->job_id << "] " << iter->cmd->cmd_line << " : " << iter->process_id << " "
-             << difftime(time(NULL), iter->start_time) << " secs";
+        printDone(iter->job_id);
+        if(iter->state == PENDING){
+            cout << "[" << iter->job_id << "] " << iter->cmd->cmd_line << " : after";
+            for(size_t i = 0; i < iter->depends_on.size(); i++){
+                cout << " %" << iter->depends_on[i];
+            }
+            cout << " (pending)";
+        }
+        else{
+            cout << "[" << iter->job_id << "] " << iter->cmd->cmd_line << " : " << iter->process_id << " "
+                 << difftime(time(NULL), iter->start_time) << " secs";
+        }
         if(iter->state == STOPPED){
             cout << " (stopped)";
         }
-        cout << endl;
+        if(verbose && (iter->cmd->limits.any() || iter->cmd->sched.any())){
+            cout << " [" << (_formatLimits(iter->cmd->limits) + _formatSched(iter->cmd->sched)).substr(1) << "]";
+        }
+        cout << "\n"; //flushed once below, not once per job
     }
+    printDone(INT_MAX);
+    finished_captured.clear();
+    cout << flush;
+}
+
+static bool _jobIdLess(const JobsList::JobEntry& job, int job_id){
+    return job.job_id < job_id;
 }
 
-void JobsList::addJob(Command* cmd, Job_State state, int job_id){
+int JobsList::addJob(std::unique_ptr<Command> cmd, Job_State state, int job_id){
     SmallShell& smash = SmallShell::getInstance();
     int new_job_id;
     //cout << "job_id is: " << job_id << endl;
     //cout << "max is: " << max << endl;
-    removeFinishedJobs();
+    if(state != PENDING){ //a pending job has no process to look for, and reaping here could drop its dependencies unseen
+        removeFinishedJobs();
+    }
+    for(size_t i = 0; i < unclaimed.size(); i++){
+        if(unclaimed[i].first == cmd->pid){ //it ended before it could be listed
+            if(job_id != -1){
+                recordExit(job_id, unclaimed[i].second);
+            }
+            return -1;
+        }
+    }
     updateMax();
     //cout << "after update max is: " << max << endl;
     if(job_id == -1){
         
-        if(jobs_list->size() == 0){
-            new_job_id = 1;
+        new_job_id = jobs_list->empty() ? 0 : max;
+        if(!finished_captured.empty()){
+            new_job_id = std::max(new_job_id, finished_captured.rbegin()->first);
         }
-        else {
-            new_job_id = max + 1;
-        }   
+        new_job_id++;
         max = new_job_id;
-        JobEntry new_job = JobEntry(cmd->pid, new_job_id, cmd, state);
-        jobs_list->push_back(new_job);
+        int process_id = cmd->pid;
+        jobs_list->push_back(JobEntry(process_id, new_job_id, std::move(cmd), state));
     }
     else{
         new_job_id = job_id;
-        vector<JobsList::JobEntry>::iterator iter;
-        iter = jobs_list->begin();
-        while(iter->job_id < new_job_id && iter != jobs_list->end()){
-            iter++;
-        }
-        JobEntry new_job = JobEntry(cmd->pid, new_job_id, cmd, state);
-        jobs_list->insert(iter, new_job);
+        vector<JobsList::JobEntry>::iterator iter = lower_bound(jobs_list->begin(), jobs_list->end(), new_job_id, _jobIdLess);
+        int process_id = cmd->pid;
+        jobs_list->insert(iter, JobEntry(process_id, new_job_id, std::move(cmd), state));
     }
     updateMax();
+    return new_job_id;
 }
 
 void JobsList::updateMax() {
-    vector<JobsList::JobEntry>::iterator iter;
-    iter = jobs_list->begin();
-    while(iter != jobs_list->end()){
-        max = iter->job_id;
-        iter++;
+    if(!jobs_list->empty()){ //ids are kept sorted, the last job has the highest one
+        max = jobs_list->back().job_id;
     }
 }
 
 JobsList::JobEntry* JobsList::getJobById(int jobId) {
-    vector<JobsList::JobEntry>::iterator iter;
-    for(iter = jobs_list->begin();iter != jobs_list->end() ;iter++){
-        if (iter->job_id == jobId)
-        {
-            return &*iter;
-        }
+    vector<JobsList::JobEntry>::iterator iter = lower_bound(jobs_list->begin(), jobs_list->end(), jobId, _jobIdLess);
+    if(iter != jobs_list->end() && iter->job_id == jobId){
+        return &*iter;
     }
     return nullptr; //didn't find this Job Id
 }
 
 void JobsList::removeJobById(int jobId) {
-    vector<JobsList::JobEntry>::iterator iter;
-    for(iter = jobs_list->begin();iter != jobs_list->end() ;iter++){
-        if (iter->job_id == jobId)
-        {
-            jobs_list->erase(iter);
-            return;
-        }
+    vector<JobsList::JobEntry>::iterator iter = lower_bound(jobs_list->begin(), jobs_list->end(), jobId, _jobIdLess);
+    if(iter != jobs_list->end() && iter->job_id == jobId){
+        jobs_list->erase(iter);
     }
 }
 
@@ -431,74 +1781,208 @@ JobsList::JobEntry* JobsList::getLastStoppedJob() {
     return nullptr;
 }
 
+/**
+* Reaps whatever changed state with waitpid(-1) instead of asking every job, so a prompt costs one
+* syscall no matter how many jobs there are, and the list is only walked when something happened
+*/
 void JobsList::removeFinishedJobs() {
-
-    if (jobs_list->size() == 0) {
+    if(getpid() != owner){ //a child's waitpid(-1) sees none of the jobs, it would drop them all and start the pending ones
         return;
     }
-    vector<JobsList::JobEntry>::iterator iter = jobs_list->begin();
-    for (; iter <= jobs_list->end();) {
-        //we will check if wait gives us jobs that are done and not stopped
-        if(iter==jobs_list->end()){
-            updateMax();
-            return;
+    unclaimed.clear();
+    unordered_map<pid_t, int> changed; //pid -> its latest status
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0){
+        changed[pid] = status;
+    }
+    bool no_children = pid == -1 && errno == ECHILD; //nothing started can still be running
+    if(changed.empty() && !no_children){
+        return;
+    }
+    unordered_set<pid_t> finished;
+    for(vector<JobsList::JobEntry>::iterator iter = jobs_list->begin(); iter != jobs_list->end(); iter++){
+        unordered_map<pid_t, int>::iterator found = changed.find(iter->process_id);
+        if(found == changed.end()){
+            continue;
         }
-        int status;
-        pid_t return_pid = waitpid(iter->process_id, &status, WNOHANG | WUNTRACED | WCONTINUED);
-        if (return_pid > 0 || return_pid == -1) {
-            if(WIFSIGNALED(status) || WIFEXITED(status))
-            {
-                jobs_list->erase(iter);
-                continue; //erase increases the iterator
-            }
-            else if(WIFSTOPPED(status))
-            {
-                iter->state = STOPPED;
-            }
-            else if(WIFCONTINUED(status))
-            {
-                iter->state = BACKGROUND;
+        status = found->second;
+        changed.erase(found);
+        if(WIFSIGNALED(status) || WIFEXITED(status)){
+            finished.insert(iter->process_id);
+            recordExit(iter->job_id, status);
+        }
+        else if(WIFSTOPPED(status)){
+            iter->state = STOPPED;
+        }
+        else if(WIFCONTINUED(status)){
+            iter->state = BACKGROUND;
+        }
+    }
+    //children that aren't listed yet, addJob checks the one it is adding against these
+    for(unordered_map<pid_t, int>::iterator iter = changed.begin(); iter != changed.end(); iter++){
+        if(WIFSIGNALED(iter->second) || WIFEXITED(iter->second)){
+            unclaimed.push_back(make_pair(iter->first, iter->second));
+        }
+    }
+    if(!finished.empty() || no_children){
+        for(vector<JobsList::JobEntry>::iterator iter = jobs_list->begin(); iter != jobs_list->end(); iter++){
+            bool done = finished.count(iter->process_id) != 0 || (no_children && iter->state != PENDING);
+            if(done && iter->cmd->output.ring != nullptr){ //output <id> may still ask for it
+                finished_captured[iter->job_id] = std::move(iter->cmd);
             }
         }
-        iter++;
+        jobs_list->erase(remove_if(jobs_list->begin(), jobs_list->end(), [&finished, no_children](const JobsList::JobEntry& job){
+            return finished.count(job.process_id) != 0 || (no_children && job.state != PENDING);
+        }), jobs_list->end()); //frees the jobs' commands
+        updateMax();
+        startReadyJobs();
     }
-    return;
-}
-
-JobsList::JobsList(){
-    jobs_list = new vector<JobsList::JobEntry>;
-}
-
-JobsList::~JobsList(){
-    delete(jobs_list);
 }
 
-void JobsList::killAllJobs(){
-    SmallShell& smash = SmallShell::getInstance();
-    vector<JobsList::JobEntry>* job_list = smash.Jobs_List->getJobsList();
-    vector<JobsList::JobEntry>::iterator iter;
-    removeFinishedJobs();
-    cout << "smash: sending SIGKILL signal to " << smash.Jobs_List->getJobsList()->size() << " jobs:" << endl;
-    for(iter = job_list->begin();iter != job_list->end() ;iter++){
-        cout << iter->process_id << ": " << iter->cmd->cmd_line << endl;
-        int killed = kill(iter->process_id, SIGKILL);
-        if(killed == -1){
-            perror("smash error: kill failed");
+bool JobsList::hasPending() {
+    for(vector<JobsList::JobEntry>::iterator iter = jobs_list->begin(); iter != jobs_list->end(); iter++){
+        if(iter->state == PENDING){
+            return true;
         }
     }
+    return false;
 }
 
-vector<JobsList::JobEntry>* JobsList::getJobsList(){
-    return jobs_list;
+//keeps how a job ended for the pending jobs that depend on it
+void JobsList::recordExit(int job_id, int status) {
+    if(collecting){
+        collected.push_back(make_pair(job_id, status));
+    }
+    if(hasPending()){
+        exit_statuses[job_id] = status;
+    }
 }
 
-/***************************************************************************
-****************************************************************************
-*******************************SHOW_PID*************************************
-****************************************************************************
-***************************************************************************/
+//drops a pending job. it counts as failed for whatever waits on it with --ok
+void JobsList::cancelJob(int job_id) {
+    removeJobById(job_id);
+    recordExit(job_id, 1 << 8); //the wait status of exit(1)
+}
 
-ShowPidCommand::ShowPidCommand(const char* cmd_line, int pid) : BuiltInCommand(cmd_line, pid) {}
+/**
+* The dependency scheduler. starts every pending job whose dependencies all left the list, as far
+* as the concurrency cap allows, and cancels --ok jobs whose dependencies didn't all succeed. runs
+* whenever a job is reaped, so a chain advances as soon as each step ends, with no polling
+*/
+void JobsList::startReadyJobs() {
+    SmallShell& smash = SmallShell::getInstance();
+    //launching below reaps too, the outer pass picks up whatever that changes. and pending jobs are
+    //started by the shell only, never by a forked copy of it
+    if(scheduling || getpid() != owner){
+        return;
+    }
+    scheduling = true;
+    bool progress = true;
+    while(progress){
+        progress = false;
+        int running = 0;
+        vector<int> ready, cancelled;
+        for(vector<JobsList::JobEntry>::iterator iter = jobs_list->begin(); iter != jobs_list->end(); iter++){
+            if(iter->scheduled && iter->state != PENDING){
+                running++;
+            }
+        }
+        for(vector<JobsList::JobEntry>::iterator iter = jobs_list->begin(); iter != jobs_list->end(); iter++){
+            if(iter->state != PENDING){
+                continue;
+            }
+            bool waiting = false;
+            bool failed = false;
+            for(size_t i = 0; i < iter->depends_on.size() && !waiting; i++){
+                if(getJobById(iter->depends_on[i]) != nullptr){
+                    waiting = true;
+                    break;
+                }
+                map<int, int>::iterator status = exit_statuses.find(iter->depends_on[i]);
+                failed = failed || status == exit_statuses.end() || !WIFEXITED(status->second) || WEXITSTATUS(status->second) != 0;
+            }
+            if(waiting){
+                continue;
+            }
+            if(iter->needs_success && failed){
+                cancelled.push_back(iter->job_id);
+            }
+            else if(max_scheduled == 0 || running < max_scheduled){
+                ready.push_back(iter->job_id);
+                running++;
+            }
+        }
+        for(size_t i = 0; i < cancelled.size(); i++){
+            cout << "smash: job " << cancelled[i] << " cancelled, a dependency failed" << endl;
+            cancelJob(cancelled[i]);
+            progress = true;
+        }
+        for(size_t i = 0; i < ready.size(); i++){
+            //taken off the list while it starts, so launching can't move it under us, then listed again under its id
+            std::unique_ptr<Command> cmd = std::move(getJobById(ready[i])->cmd);
+            removeJobById(ready[i]);
+            int saved_status = smash.last_status; //whatever command reaped us keeps its own status
+            smash.last_status = 0;
+            cmd->execute();
+            int status = smash.last_status;
+            smash.last_status = saved_status;
+            Job_State state = cmd->job_state;
+            if(state == FOREGROUND){ //ran in smash itself and is already done
+                recordExit(ready[i], status << 8); //the wait status of exit(status)
+            }
+            else{
+                int job_id = addJob(std::move(cmd), state, getJobById(ready[i]) == nullptr ? ready[i] : -1);
+                if(job_id != -1){
+                    getJobById(job_id)->scheduled = true;
+                }
+            }
+            progress = true;
+        }
+    }
+    if(!hasPending()){
+        exit_statuses.clear();
+    }
+    scheduling = false;
+}
+
+JobsList::JobsList() : max(0), max_scheduled(0), scheduling(false), owner(getpid()), collecting(false) {
+    jobs_list = new vector<JobsList::JobEntry>;
+}
+
+JobsList::~JobsList(){
+    delete(jobs_list);
+}
+
+void JobsList::killAllJobs(){
+    SmallShell& smash = SmallShell::getInstance();
+    vector<JobsList::JobEntry>* job_list = smash.Jobs_List->getJobsList();
+    vector<JobsList::JobEntry>::iterator iter;
+    removeFinishedJobs();
+    job_list->erase(remove_if(job_list->begin(), job_list->end(), [](const JobsList::JobEntry& job){
+        return job.state == PENDING; //never started, nothing to kill
+    }), job_list->end());
+    cout << "smash: sending SIGKILL signal to " << smash.Jobs_List->getJobsList()->size() << " jobs:" << endl;
+    for(iter = job_list->begin();iter != job_list->end() ;iter++){
+        cout << iter->process_id << ": " << iter->cmd->cmd_line << "\n";
+        if(!iter->signal(SIGKILL) && errno != ESRCH){ //ESRCH: it already exited, nothing left to kill
+            perror("smash error: kill failed");
+        }
+    }
+    cout << flush;
+}
+
+vector<JobsList::JobEntry>* JobsList::getJobsList(){
+    return jobs_list;
+}
+
+/***************************************************************************
+****************************************************************************
+*******************************SHOW_PID*************************************
+****************************************************************************
+***************************************************************************/
+
+ShowPidCommand::ShowPidCommand(const char* cmd_line, int pid) : BuiltInCommand(cmd_line, pid) {}
 
 void ShowPidCommand::execute(){
     std::cout << "smash pid is ";
@@ -514,11 +1998,11 @@ void ShowPidCommand::execute(){
 JobsCommand::JobsCommand(const char* cmd_line, JobsList* job_list, int pid): BuiltInCommand(cmd_line, pid), job_list(job_list) {}
 
 void JobsCommand::execute(){
-    if (job_list->jobs_list->size() == 0) //if the list is empty we should print nothing. according to piazza
+    if (job_list->jobs_list->size() == 0 && job_list->finished_captured.empty()) //if the list is empty we should print nothing. according to piazza
     {
         return;
     }
-    job_list->printJobsList();
+    job_list->printJobsList(num_of_args > 1 && strcmp(args[1], "-v") == 0);
 }
 
 /***************************************************************************
@@ -530,11 +2014,12 @@ void JobsCommand::execute(){
 ForegroundCommand::ForegroundCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), job_list(job_list) {}
 
 void ForegroundCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
     if(num_of_args > 2 || (num_of_args > 1 && !(is_digits(string(args[1]))))){
         cerr << "smash error: fg: invalid arguments" << endl;
+        smash.last_status = 1;
         return;
     }
-    SmallShell& smash = SmallShell::getInstance();
     smash.Jobs_List->removeFinishedJobs();
     vector<JobsList::JobEntry>* job_list = smash.Jobs_List->getJobsList();
     vector<JobsList::JobEntry>::iterator iter;
@@ -544,37 +2029,55 @@ void ForegroundCommand::execute(){
         JobsList::JobEntry* job1 = smash.Jobs_List->getJobById(job_id);
         if(job1 == nullptr){
             cerr << "smash error: fg: job-id " << job_id << " does not exist" << endl;
+            smash.last_status = 1;
             return;
         }
     }
     if(num_of_args == 1){
         if(job_list->size() == 0){
             cerr << "smash error: fg: jobs list is empty" << endl;
+            smash.last_status = 1;
             return;
         }
         job_id = smash.Jobs_List->max;
     }
     JobsList::JobEntry* job = smash.Jobs_List->getJobById(job_id);
+    if(job->state == PENDING) {
+        cerr << "smash error: fg: job-id " << job_id << " is pending" << endl;
+        smash.last_status = 1;
+        return;
+    }
     if(job->state == BACKGROUND) {
-        if (kill(job->process_id, SIGSTOP) == -1) {
+        if (!job->signal(SIGSTOP)) {
             perror("smash error: kill failed");
+            smash.last_status = 1;
             return;
         }
     }
-    if(kill(job->process_id, SIGCONT) == -1) {
+    if(!job->signal(SIGCONT)) {
         perror("smash error: kill failed");
+        smash.last_status = 1;
         return;
     }
     job->state = FOREGROUND; ///if didnt return than it worked
     cout << job->cmd->cmd_line << " : " << job->process_id << endl;
-    smash.fg_cmd = job->cmd;
+    std::unique_ptr<Command> cmd = std::move(job->cmd); //fg owns the command while it runs
+    smash.fg_cmd = cmd.get();
     smash.fg_cmd_job_id = job->job_id;
     int pid = job->process_id;
     smash.Jobs_List->removeJobById(job_id);
-    waitpid(pid, NULL, WUNTRACED);
-    delete smash.fg_cmd;
+    int status = 0;
+    waitpid(pid, &status, WUNTRACED);
     smash.fg_cmd = nullptr;
     smash.fg_cmd_job_id = -1;
+    smash.last_status = _exitStatus(status);
+    if(WIFSTOPPED(status)){ //stopped again, back to the list under the same job id
+        smash.Jobs_List->addJob(std::move(cmd), STOPPED, job_id);
+    }
+    else{
+        smash.Jobs_List->recordExit(job_id, status);
+        smash.Jobs_List->startReadyJobs();
+    }
 }
 
 /***************************************************************************
@@ -594,6 +2097,7 @@ void BackgroundCommand::execute(){
     if(num_of_args > 1){
         if(num_of_args > 2 || !(is_digits(string(args[1])))){
             cerr << "smash error: bg: invalid arguments" << endl;
+            smash.last_status = 1;
             return;
         }
         else{
@@ -601,10 +2105,17 @@ void BackgroundCommand::execute(){
             job = smash.Jobs_List->getJobById(wanted_job_id);
             if(job == nullptr){
                 cerr << "smash error: bg: job-id " << wanted_job_id <<  " does not exist" << endl;
+                smash.last_status = 1;
+                return;
+            }
+            if(job->state == PENDING){
+                cerr << "smash error: bg: job-id " << job->job_id << " is pending" << endl;
+                smash.last_status = 1;
                 return;
             }
             if(job->state != STOPPED){
                 cerr << "smash error: bg: job-id " << job->job_id << " is already running in the background" << endl;
+                smash.last_status = 1;
                 return;
             }
         }
@@ -613,12 +2124,14 @@ void BackgroundCommand::execute(){
         job = smash.Jobs_List->getLastStoppedJob();
         if(job == nullptr){
             cerr << "smash error: bg: there is no stopped jobs to resume" << endl;
+            smash.last_status = 1;
             return;
         }
     }
     cout << job->cmd->cmd_line << " : " << job->process_id << endl;
-    if(kill(job->process_id, SIGCONT) == -1) {
+    if(!job->signal(SIGCONT)) {
         perror("smash error: kill failed");
+        smash.last_status = 1;
         return;
     }
     job->state = BACKGROUND;
@@ -637,10 +2150,12 @@ void ChangeDirCommand::execute(){
     if (num_of_args == 1) //no parameters were given so according to pg 2 in pdf
     {
         cerr << "smash error:> " + QUOTATION + (string)cmd_line + QUOTATION  << endl;
+        smash.last_status = 1;
         return;
     }
     else if(num_of_args > 2){
         cerr << "smash error: cd: too many arguments" << endl;
+        smash.last_status = 1;
         return;
     }
     char* current_path = getcwd(nullptr, 0);
@@ -649,16 +2164,22 @@ void ChangeDirCommand::execute(){
     if (current_path == nullptr) //if the system call fails then according to error handling. check if need to write NULL instead of nullptr
     {
         perror("smash error: getcwd failed");
+        smash.last_status = 1;
         return;
     }
+    std::unique_ptr<char, void(*)(void*)> current_path_owner(current_path, free); //freed on every error path
 
-    else if(num_of_args > 1){ //num of args is 2 meaning the cmd line and the argument
+    if(num_of_args > 1){ //num of args is 2 meaning the cmd line and the argument
         if(*args[1] == '&'){ //we should ignore background
             if(num_of_args > 2) {
+                free(args[1]);
                 args[1] = args[2];
+                args[2] = nullptr;
+                num_of_args--;
             }
             else{ //not valid parameters given- no arguments (only cd &)
                 cout << "smash error:>" + QUOTATION + (string)cmd_line + QUOTATION  << endl; //check if to cerr
+                smash.last_status = 1;
                 return;
             }
         }
@@ -668,6 +2189,7 @@ void ChangeDirCommand::execute(){
             if (*plastPwd == nullptr) //there wasn't a prev working directory
             {
                 cerr << "smash error: cd: OLDPWD not set" << endl;
+                smash.last_status = 1;
                 return;
             }
             else //there is a prev directory to change to
@@ -676,6 +2198,7 @@ void ChangeDirCommand::execute(){
                 if (changed != 0) //chdir failed (this is a system call so perror)
                 {
                     perror("smash error: chdir failed");
+                    smash.last_status = 1;
                     return;
                 }
                 //if it is 0 then it was success and changed the directory.
@@ -687,11 +2210,12 @@ void ChangeDirCommand::execute(){
             if (changed != 0) //syscall failed
             {
                 perror("smash error: chdir failed");
+                smash.last_status = 1;
                 return;
             }
         }
         free(*plastPwd); //this is the prev prev working directory. maybe not to delete because a couple of - in a row?
-        *plastPwd = current_path; //path before this change so now its the prev
+        *plastPwd = current_path_owner.release(); //path before this change so now its the prev
         return;
     }
 }
@@ -705,8 +2229,15 @@ void ChangeDirCommand::execute(){
 GetCurrDirCommand::GetCurrDirCommand(const char* cmd_line, int pid) : BuiltInCommand(cmd_line, pid) {}
 
 void GetCurrDirCommand::execute(){
-    string pwd = getcwd(NULL, 0);
+    SmallShell& smash = SmallShell::getInstance();
+    char* pwd = getcwd(NULL, 0);
+    if(pwd == nullptr){
+        perror("smash error: getcwd failed");
+        smash.last_status = 1;
+        return;
+    }
     std::cout << pwd << std::endl;
+    free(pwd);
 }
 
 /***************************************************************************
@@ -739,32 +2270,585 @@ void QuitCommand::execute() {
 
 KillCommand::KillCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs) {}
 
+//-9, -KILL or -SIGKILL. returns 0 if it isn't a signal
+static int _parseSignal(const char* arg){
+    if(arg[0] != '-' || arg[1] == '\0'){
+        return 0;
+    }
+    string name(arg + 1);
+    if(is_digits(name)){
+        int sig = atoi(name.c_str());
+        return (sig > 0 && sig < NSIG) ? sig : 0;
+    }
+    if(name.compare(0, 3, "SIG") == 0){
+        name = name.substr(3);
+    }
+    for(int sig = 1; sig < NSIG; sig++){
+        const char* abbrev = sigabbrev_np(sig);
+        if(abbrev != nullptr && name == abbrev){
+            return sig;
+        }
+    }
+    return 0;
+}
+
+/**
+* Picks the jobs named by args[i..]: a job-id, %N, a range %N-M, --stopped or --all.
+* jobs come out in job-id order and each one once, however many targets name it
+*/
+bool KillCommand::selectJobs(vector<JobsList::JobEntry*>& selected){
+    SmallShell& smash = SmallShell::getInstance();
+    vector<pair<int, int>> ranges;
+    bool stopped = false;
+    bool all = false;
+    for(int i = 2; i < num_of_args; i++){
+        string target(args[i]);
+        if(target == "-g" || target == "--group"){
+            continue;
+        }
+        if(target == "--stopped"){
+            stopped = true;
+            continue;
+        }
+        if(target == "--all"){
+            all = true;
+            continue;
+        }
+        bool percent = target[0] == '%';
+        if(percent){
+            target = target.substr(1);
+        }
+        size_t dash = target.find('-', 1);
+        string low = target.substr(0, dash);
+        string high = dash == string::npos ? low : target.substr(dash + 1);
+        if(low.empty() || high.empty() || low.find_first_not_of("0123456789") != string::npos ||
+           high.find_first_not_of("0123456789") != string::npos || (dash != string::npos && !percent)){
+            cerr << "smash error: kill: invalid arguments" << endl;
+            smash.last_status = 1;
+            return false;
+        }
+        int first = atoi(low.c_str());
+        int last = atoi(high.c_str());
+        if(first > last){
+            cerr << "smash error: kill: invalid arguments" << endl;
+            smash.last_status = 1;
+            return false;
+        }
+        if(dash == string::npos && jobs->getJobById(first) == nullptr){ //a single job that isn't there is an error, a range just matches less
+            cerr << "smash error: kill: job-id " << first << " does not exist" << endl;
+            smash.last_status = 1;
+            return false;
+        }
+        ranges.push_back(make_pair(first, last));
+    }
+    if(ranges.empty() && !stopped && !all){
+        cerr << "smash error: kill: invalid arguments" << endl;
+        smash.last_status = 1;
+        return false;
+    }
+    vector<JobsList::JobEntry>* job_list = jobs->getJobsList();
+    for(vector<JobsList::JobEntry>::iterator iter = job_list->begin(); iter != job_list->end(); iter++){
+        bool wanted = all || (stopped && iter->state == STOPPED);
+        for(size_t r = 0; r < ranges.size() && !wanted; r++){
+            wanted = iter->job_id >= ranges[r].first && iter->job_id <= ranges[r].second;
+        }
+        if(wanted){
+            selected.push_back(&*iter);
+        }
+    }
+    return true;
+}
+
+/**
+* kill -SIG [-g] <job-id|%N|%N-M|--stopped|--all>...
+* signals go through each job's pidfd, so a job that exited and whose pid was reused can't hit
+* an unrelated process. -g signals the job's whole process group instead of its first process
+*/
 void KillCommand::execute(){
-    if(num_of_args != 3 || !(is_digits((string)(args[1]))) || !(is_digits((string)(args[2])))){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    int signal = num_of_args >= 3 ? _parseSignal(args[1]) : 0;
+    if(signal == 0){
         cerr << "smash error: kill: invalid arguments" << endl;
+        smash.last_status = 1;
         return;
     }
-    int sig = atoi(args[1]);
-    if(sig >= 0){
-        cerr << "smash error: kill: invalid arguments" << endl;
+    bool group = false;
+    for(int i = 2; i < num_of_args; i++){
+        group = group || strcmp(args[i], "-g") == 0 || strcmp(args[i], "--group") == 0;
+    }
+    vector<JobsList::JobEntry*> selected;
+    if(!selectJobs(selected)){
         return;
     }
+    string report; //one write for the whole batch, a range can name thousands of jobs
+    vector<int> cancelled;
+    for(size_t i = 0; i < selected.size(); i++){
+        if(selected[i]->state == PENDING){ //never started: killing it means it won't start
+            cancelled.push_back(selected[i]->job_id);
+            report += "job " + std::to_string(selected[i]->job_id) + " cancelled\n";
+            continue;
+        }
+        if(!selected[i]->signal(signal, group)){
+            cout << report << flush;
+            report.clear();
+            perror("smash error: kill failed");
+            smash.last_status = 1;
+            continue;
+        }
+        report += "signal number " + std::to_string(signal) + " was sent to pid " + std::to_string(selected[i]->process_id) + "\n";
+    }
+    cout << report << flush;
+    for(size_t i = 0; i < cancelled.size(); i++){
+        jobs->cancelJob(cancelled[i]);
+    }
+    if(!cancelled.empty()){
+        jobs->startReadyJobs(); //whatever waited on them may go now, or be cancelled too
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************AFTER**************************************
+****************************************************************************
+***************************************************************************/
+
+AfterCommand::AfterCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs) {}
+
+/**
+* after [-j N] [--ok] <job-id|%N>... -- <cmd>
+* cmd is created now (so $VARs are expanded now) and listed as a PENDING job. the scheduler in
+* JobsList starts it in the background once every listed job is gone. -j sets the global cap on
+* how many scheduler started jobs run at once, after -j N alone only changes the cap
+*/
+void AfterCommand::execute(){
     SmallShell& smash = SmallShell::getInstance();
-    vector<JobsList::JobEntry>* job_list = smash.Jobs_List->getJobsList();
-    vector<JobsList::JobEntry>::iterator iter;
-    JobsList::JobEntry* job;
-    int wanted_job_id = atoi(args[2]);
-    int signal = std::abs(atoi(args[1]));
-    job = smash.Jobs_List->getJobById(wanted_job_id);
-    if(job == nullptr){
-        cerr << "smash error: kill: job-id " << wanted_job_id << " does not exist" << endl;
+    vector<int> depends_on;
+    bool needs_success = false;
+    int i = 1;
+    //reaped once, before the dependencies are checked. the job is listed with no reaping in between,
+    //so its id is above all of theirs and a dependency can't end unnoticed meanwhile
+    jobs->removeFinishedJobs();
+    for(; i < num_of_args && strcmp(args[i], "--") != 0; i++){
+        if(strcmp(args[i], "-j") == 0 && i + 1 < num_of_args && is_digits(args[i + 1]) && *args[i + 1] != '-'){
+            jobs->max_scheduled = atoi(args[++i]);
+        }
+        else if(strcmp(args[i], "--ok") == 0){
+            needs_success = true;
+        }
+        else{
+            const char* id = args[i] + (*args[i] == '%' ? 1 : 0);
+            if(*id == '\0' || *id == '-' || !is_digits(id)){
+                cerr << "smash error: after: invalid arguments" << endl;
+                smash.last_status = 1;
+                return;
+            }
+            if(jobs->getJobById(atoi(id)) == nullptr){
+                cerr << "smash error: after: job-id " << id << " does not exist" << endl;
+                smash.last_status = 1;
+                return;
+            }
+            depends_on.push_back(atoi(id));
+        }
+    }
+    string inner = i < num_of_args ? _skipWords(cmd_line, i + 1) : "";
+    if(depends_on.empty() && inner.empty() && i == num_of_args){ //after -j N
+        jobs->startReadyJobs();
         return;
     }
-    if(kill(job->process_id, signal) == -1){
-        perror("smash error: kill failed");
+    if(depends_on.empty() || inner.empty()){
+        cerr << "smash error: after: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    if(!_isBackgroundCommand(inner.c_str())){ //it starts when nobody is waiting for it
+        inner += " &";
+    }
+    std::unique_ptr<Command> cmd(smash.CreateCommand(inner.c_str()));
+    _takePendingAttrs(cmd.get()); //limit/sched/capture after ... apply to the command, not to after
+    int job_id = jobs->addJob(std::move(cmd), PENDING, -1);
+    JobsList::JobEntry* job = jobs->getJobById(job_id);
+    job->depends_on = depends_on;
+    job->needs_success = needs_success;
+    jobs->startReadyJobs();
+}
+
+/***************************************************************************
+****************************************************************************
+********************************JOBSTAT*************************************
+****************************************************************************
+***************************************************************************/
+
+JobStatCommand::JobStatCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs), interval(1), count(1) {
+    is_in_bg = _isBackgroundCommand(cmd_line);
+}
+
+void JobStatCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    bool count_given = false, interval_given = false;
+    for(int i = 1; i < num_of_args; i++){
+        if(strcmp(args[i], "-i") == 0 && i + 1 < num_of_args){
+            char* end;
+            interval = strtod(args[++i], &end);
+            if(*end != '\0' || !(interval > 0)){
+                cerr << "smash error: jobstat: invalid arguments" << endl;
+                smash.last_status = 1;
+                return;
+            }
+            interval_given = true;
+        }
+        else if(strcmp(args[i], "-n") == 0 && i + 1 < num_of_args && is_digits(args[i + 1]) && atoi(args[i + 1]) > 0){
+            count = atoi(args[++i]);
+            count_given = true;
+        }
+        else{
+            cerr << "smash error: jobstat: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    if(interval_given && !count_given){
+        count = -1; //until it's killed
+    }
+    launchForked();
+}
+
+//one process of a job's group. its /proc files stay open, every sample is a pread from offset 0
+struct StatProc {
+    int stat_fd;
+    int statm_fd;
+    int io_fd; //-1 when /proc/<pid>/io can't be opened
+    size_t row;
+    double sampled_at; //boot time seconds of the previous sample
+    unsigned long long cpu_ticks;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+};
+
+struct StatRow {
+    int job_id;
+    pid_t pgid;
+    string cmd_line;
+    bool pending;
+    int procs;
+    char state;
+    double cpu;
+    long long rss;
+    double read_rate;
+    double write_rate;
+};
+
+static bool _preadProc(int fd, char* buf, size_t size){
+    ssize_t len = pread(fd, buf, size - 1, 0);
+    if(len <= 0){
+        return false;
+    }
+    buf[len] = '\0';
+    return true;
+}
+
+//the fields after "(comm)", comm itself can hold spaces and parentheses
+static bool _parseProcStat(const char* buf, char& state, pid_t& pgid, unsigned long long& ticks, unsigned long long& start){
+    const char* rest = strrchr(buf, ')');
+    unsigned long long utime, stime;
+    if(rest == nullptr || sscanf(rest + 1, " %c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+                                 &state, &pgid, &utime, &stime, &start) != 5){
+        return false;
+    }
+    ticks = utime + stime;
+    return true;
+}
+
+static void _closeStatProc(StatProc& proc){
+    close(proc.stat_fd);
+    close(proc.statm_fd);
+    if(proc.io_fd != -1){
+        close(proc.io_fd);
+    }
+}
+
+//4.2M style, rates and rss are rarely round numbers
+static string _shortSize(double bytes){
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    int unit = 0;
+    while(unit < 4 && bytes >= 1024){
+        bytes /= 1024;
+        unit++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.1f%s", bytes, units[unit]);
+    return buf;
+}
+
+/**
+* Works on the copy of the jobs list the child got at fork. /proc is rescanned with one rewinddir per
+* sample to catch new members of the job groups. a pid is opened only the first time it shows up,
+* pids of other groups are remembered and skipped after that, so a sample of thousands of jobs
+* costs one getdents walk plus three preads per job process
+*/
+void JobStatCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    _raiseNofileLimit(); //prepareChild restored the original limit, this holds three fds per process
+    vector<StatRow> rows;
+    unordered_map<pid_t, size_t> row_of_group;
+    for(auto& job : *jobs->getJobsList()){
+        StatRow row = {job.job_id, -1, job.cmd->cmd_line, job.state == PENDING, 0, '-', 0, 0, 0, 0};
+        if(!row.pending){
+            row.pgid = job.process_id; //every job is forked into a group of its own
+            row_of_group[row.pgid] = rows.size();
+        }
+        rows.push_back(row);
+    }
+    DIR* proc_dir = opendir("/proc");
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(proc_dir == nullptr || timer == -1){
+        perror("smash error: jobstat failed");
+        smash.last_status = 1;
+        return;
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = spec.it_value.tv_sec = (time_t)interval;
+    spec.it_interval.tv_nsec = spec.it_value.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+    if(timerfd_settime(timer, 0, &spec, nullptr) == -1){
+        perror("smash error: timerfd_settime failed");
+        smash.last_status = 1;
+        return;
+    }
+    long hz = sysconf(_SC_CLK_TCK);
+    long page_size = sysconf(_SC_PAGESIZE);
+    bool tty = isatty(STDOUT);
+    unordered_map<pid_t, StatProc> procs;
+    unordered_set<pid_t> foreign, still_foreign;
+    char buf[1024];
+    string frame;
+    for(int sample = 0; count == -1 || sample < count; sample++){
+        uint64_t expirations;
+        while(sample > 0 && read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)){
+            if(errno != EINTR){
+                perror("smash error: read failed");
+                smash.last_status = 1;
+                return;
+            }
+        }
+        struct timespec now_ts;
+        clock_gettime(CLOCK_BOOTTIME, &now_ts); //the clock /proc/<pid>/stat start times count on
+        double now = now_ts.tv_sec + now_ts.tv_nsec / 1e9;
+        rewinddir(proc_dir);
+        still_foreign.clear();
+        struct dirent* entry;
+        while((entry = readdir(proc_dir)) != nullptr){
+            if(!isdigit(entry->d_name[0])){
+                continue;
+            }
+            pid_t pid = atoi(entry->d_name);
+            if(procs.count(pid)){
+                continue;
+            }
+            if(foreign.count(pid)){
+                still_foreign.insert(pid);
+                continue;
+            }
+            string dir = string("/proc/") + entry->d_name;
+            StatProc proc;
+            proc.stat_fd = open((dir + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+            char state;
+            pid_t pgid;
+            unsigned long long ticks, start;
+            bool parsed = proc.stat_fd != -1 && _preadProc(proc.stat_fd, buf, sizeof(buf))
+                          && _parseProcStat(buf, state, pgid, ticks, start);
+            if(parsed && !row_of_group.count(pgid)){
+                pgid = pid; //a leader caught before its setpgrp still counts for its job
+            }
+            if(!parsed || !row_of_group.count(pgid)){
+                if(proc.stat_fd != -1){
+                    close(proc.stat_fd);
+                    still_foreign.insert(pid);
+                }
+                continue;
+            }
+            proc.statm_fd = open((dir + "/statm").c_str(), O_RDONLY | O_CLOEXEC);
+            if(proc.statm_fd == -1){
+                close(proc.stat_fd);
+                continue;
+            }
+            proc.io_fd = open((dir + "/io").c_str(), O_RDONLY | O_CLOEXEC);
+            proc.row = row_of_group[pgid];
+            proc.sampled_at = (double)start / hz; //a new process is measured over its whole life
+            proc.cpu_ticks = proc.read_bytes = proc.write_bytes = 0;
+            procs.emplace(pid, proc);
+        }
+        foreign.swap(still_foreign);
+        for(auto& row : rows){
+            row.procs = 0;
+            row.state = '-';
+            row.cpu = row.read_rate = row.write_rate = 0;
+            row.rss = 0;
+        }
+        for(auto iter = procs.begin(); iter != procs.end();){
+            StatProc& proc = iter->second;
+            char state;
+            pid_t pgid;
+            unsigned long long ticks, start;
+            if(!_preadProc(proc.stat_fd, buf, sizeof(buf)) || !_parseProcStat(buf, state, pgid, ticks, start)){
+                _closeStatProc(proc); //reaped, its pid isn't in /proc anymore
+                iter = procs.erase(iter);
+                continue;
+            }
+            StatRow& row = rows[proc.row];
+            double elapsed = now - proc.sampled_at;
+            row.procs++;
+            if(row.state == '-' || iter->first == row.pgid){
+                row.state = state;
+            }
+            if(elapsed > 0){
+                row.cpu += (double)(ticks - proc.cpu_ticks) / hz / elapsed * 100;
+            }
+            long pages;
+            if(_preadProc(proc.statm_fd, buf, sizeof(buf)) && sscanf(buf, "%*s %ld", &pages) == 1){
+                row.rss += (long long)pages * page_size;
+            }
+            unsigned long long read_bytes, write_bytes;
+            if(proc.io_fd != -1 && _preadProc(proc.io_fd, buf, sizeof(buf))
+               && sscanf(buf, "rchar: %llu wchar: %llu", &read_bytes, &write_bytes) == 2){
+                if(elapsed > 0){
+                    row.read_rate += (read_bytes - proc.read_bytes) / elapsed;
+                    row.write_rate += (write_bytes - proc.write_bytes) / elapsed;
+                }
+                proc.read_bytes = read_bytes;
+                proc.write_bytes = write_bytes;
+            }
+            proc.cpu_ticks = ticks;
+            proc.sampled_at = now;
+            ++iter;
+        }
+        frame.clear();
+        if(tty){
+            frame += "\033[H\033[2J"; //redraw in place, like top
+        }
+        else if(sample > 0){
+            frame += "\n";
+        }
+        frame += "JOB        PID S PROCS   CPU%      RSS   READ/s  WRITE/s COMMAND\n";
+        for(auto& row : rows){
+            string id = "[" + std::to_string(row.job_id) + "]";
+            if(row.pending){
+                snprintf(buf, sizeof(buf), "%-6s %6s %c %5s %6s %8s %8s %8s ", id.c_str(), "-", '-', "-", "-", "-", "-", "-");
+                frame += buf + row.cmd_line + " (pending)\n";
+                continue;
+            }
+            snprintf(buf, sizeof(buf), "%-6s %6d %c %5d %6.1f %8s %8s %8s ", id.c_str(), row.pgid, row.state, row.procs, row.cpu,
+                     _shortSize(row.rss).c_str(), _shortSize(row.read_rate).c_str(), _shortSize(row.write_rate).c_str());
+            frame += buf + row.cmd_line + "\n";
+        }
+        _writeAll(STDOUT, frame.data(), frame.size());
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************WAIT***************************************
+****************************************************************************
+***************************************************************************/
+
+WaitCommand::WaitCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs) {}
+
+/**
+* Sleeps in epoll on the pidfds of every running job, not just the waited ones, so a pending job
+* the waited ones depend on still gets started. each wakeup reaps through removeFinishedJobs, which
+* hands the statuses over in jobs->collected. ctrl-C interrupts it: SIGINT is only unblocked inside
+* epoll_pwait, so one arriving between the check and the sleep isn't missed
+*/
+void WaitCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    bool first_only = false;
+    vector<int> wanted;
+    for(int i = 1; i < num_of_args; i++){
+        if(strcmp(args[i], "-n") == 0){
+            first_only = true;
+            continue;
+        }
+        const char* id = args[i] + (*args[i] == '%' ? 1 : 0);
+        if(*id == '\0' || *id == '-' || !is_digits(id)){
+            cerr << "smash error: wait: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        if(jobs->getJobById(atoi(id)) == nullptr){
+            cerr << "smash error: wait: job-id " << id << " does not exist" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        wanted.push_back(atoi(id));
+    }
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1){
+        perror("smash error: epoll_create1 failed");
+        smash.last_status = 1;
         return;
     }
-    cout << "signal number " << signal << " was sent to pid " << job->process_id << endl;
+    unordered_map<int, pid_t> registered; //job id -> the process its pidfd was added for
+    unordered_set<int> wanted_set(wanted.begin(), wanted.end());
+    jobs->collecting = true;
+    jobs->collected.clear();
+    smash.interrupted = 0;
+    bool done = false;
+    while(!done){
+        jobs->removeFinishedJobs();
+        for(size_t i = 0; i < jobs->collected.size() && first_only; i++){
+            if(wanted.empty() || wanted_set.count(jobs->collected[i].first)){
+                smash.last_status = _exitStatus(jobs->collected[i].second);
+                done = true;
+                break;
+            }
+        }
+        bool waiting = false, unwatched = false;
+        for(auto& job : *jobs->getJobsList()){
+            bool is_wanted = wanted.empty() ? job.state != STOPPED : wanted_set.count(job.job_id) != 0;
+            waiting = waiting || is_wanted;
+            if(job.state == PENDING || registered[job.job_id] == job.process_id){
+                continue;
+            }
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u32 = job.job_id;
+            if(job.pidfd.get() == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job.pidfd.get(), &event) == -1){
+                unwatched = true; //no pidfd, noticed by the timeout below
+                continue;
+            }
+            registered[job.job_id] = job.process_id;
+        }
+        if(done || !waiting){
+            break;
+        }
+        sigset_t sigint, unblocked;
+        sigemptyset(&sigint);
+        sigaddset(&sigint, SIGINT);
+        sigprocmask(SIG_BLOCK, &sigint, &unblocked);
+        struct epoll_event events[64];
+        int ready = smash.interrupted ? -1 : epoll_pwait(epoll_fd, events, 64, unwatched ? 100 : -1, &unblocked);
+        sigprocmask(SIG_SETMASK, &unblocked, nullptr);
+        if(smash.interrupted){
+            smash.last_status = 128 + SIGINT;
+            break;
+        }
+        if(ready == -1 && errno != EINTR){
+            perror("smash error: epoll_wait failed");
+            smash.last_status = 1;
+            break;
+        }
+    }
+    if(!done && !smash.interrupted && !wanted.empty()){ //the status of the last job named
+        for(size_t i = 0; i < jobs->collected.size(); i++){
+            if(jobs->collected[i].first == wanted.back()){
+                smash.last_status = _exitStatus(jobs->collected[i].second);
+            }
+        }
+    }
+    jobs->collecting = false;
+    jobs->collected.clear();
+    close(epoll_fd);
 }
 
 /***************************************************************************
@@ -782,12 +2866,14 @@ void PipeCommand::execute(){
     int pipe_index = string(cmd_line).find_first_of("|");
     if(pipe(fd) == -1){
         perror("smash error: pipe failed");
+        smash.last_status = 1;
         return;
     }
     pid_t pid1 = fork();
     if (pid1 == -1)
     {
         perror("smash error: pipe failed");
+        smash.last_status = 1;
         return;
     }
     if(pid1 == 0){
@@ -818,6 +2904,7 @@ void PipeCommand::execute(){
     if (pid2 == -1)
     {
         perror("smash error: pipe failed");
+        smash.last_status = 1;
         return;
     }
     if(pid2 == 0){ //child
@@ -845,7 +2932,7 @@ void PipeCommand::execute(){
             return;
         }
         smash.executeCommand(cmd2.c_str()); /// need to check if null???
-        exit(0);
+        exit(smash.last_status); //a pipeline's status is its last stage's
     }
     if(close(fd[PIPE_WRITE]) == -1){ ///closing because one way pipe
         perror("smash error: close failed");
@@ -855,16 +2942,21 @@ void PipeCommand::execute(){
         perror("smash error: close failed");
         return;
     }
+    int status = 0;
     do{
         finished_1 = waitpid(pid1, NULL, WNOHANG | WUNTRACED | WCONTINUED);
-        finished_2 = waitpid(pid2, NULL, WNOHANG | WUNTRACED | WCONTINUED);
+        finished_2 = waitpid(pid2, &status, WNOHANG | WUNTRACED | WCONTINUED);
     } while(finished_1 == 0 || finished_2 == 0);
+    smash.last_status = _exitStatus(status);
     return;
 }
 
 void PipeCommand::pipe_exec(int pipe_index, bool dup){
     cmd1 = string(cmd_line).substr(0,pipe_index);
     cmd2 = string(cmd_line).substr(pipe_index+1);
+    if(cmd2[0] == '>'){ //cmd |> targets: the second stage is a tee that only writes the targets
+        cmd2 = "tee -q " + cmd2.substr(1);
+    }
     if(dup){
         if(dup2(fd[PIPE_WRITE], STDOUT) == -1){
             perror("smash error: dup2 failed");
@@ -886,53 +2978,514 @@ void PipeCommand::pipe_ampersand_exec(int pipe_index, bool dup){
 
 /***************************************************************************
 ****************************************************************************
-******************************REDIRECTION***********************************
+**********************************TEE***************************************
 ****************************************************************************
 ***************************************************************************/
 
-RedirectionCommand::RedirectionCommand(const char* cmd_line, int pid): Command(cmd_line, true, pid), cmd_str(string(cmd_line)), out_channel(-1) {}
+TeeCommand::TeeCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid) {}
 
-void RedirectionCommand::execute(){ ///needs to use prepare and cleanup
-    SmallShell& smash = SmallShell::getInstance();
-    if(cmd_str.find(">>") != std::string::npos){
-        append = true;
-    }
-    else{ //only <
-        append = false;
-    }
-    split_cmd();
-    prepare();
-    if(fixed_cmd != ""){
-        smash.executeCommand(fixed_cmd.c_str());
+struct TeeTarget {
+    int fd;
+    bool spliceable; //a pipe or a regular file
+    int mid[2]; //private pipe the data is tee()d into before it is spliced to fd
+};
+
+static bool _spliceAll(int in_fd, int out_fd, size_t len){
+    while(len > 0){
+        ssize_t moved = splice(in_fd, nullptr, out_fd, nullptr, len, SPLICE_F_MOVE);
+        if(moved <= 0){
+            if(moved == -1 && errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        len -= moved;
     }
-    cleanup();
+    return true;
 }
 
-void RedirectionCommand::split_cmd(){
-    int arrow_index = cmd_str.find_first_of(">");
-    int file_path_start = arrow_index + (append ? 2 : 1); //skip >> instead of >
-    //fixed_cmd = string(cmd_str.begin(), cmd_str.begin()+arrow_index);
-    fixed_cmd = cmd_str.substr(0, arrow_index);
-    //file_path = _trim(string(cmd_str.begin()+file_path_start, cmd_str.end()));
-    file_path = _trim(cmd_str.substr(file_path_start));
-    _removeGivenSign(const_cast<char*>(file_path.c_str()), '&');
+//like cat, a tee reading the terminal runs as a forked job so ctrl-C/ctrl-Z can stop it
+void TeeCommand::execute(){
+    if(isatty(STDIN)){
+        launchForked();
+        return;
+    }
+    childMain();
 }
 
-void RedirectionCommand::prepare() {
+void TeeCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    bool to_stdout = true, append_all = false;
+    vector<TeeTarget> targets;
+    for(int i = 1; i < num_of_args; i++){
+        string arg(args[i]);
+        if(arg == "-q"){
+            to_stdout = false;
+            continue;
+        }
+        if(arg == "-a"){
+            append_all = true;
+            continue;
+        }
+        bool append = append_all;
+        if(arg.compare(0, 2, ">>") == 0){
+            append = true;
+            arg = arg.substr(2);
+        }
+        else if(arg[0] == '>'){
+            append = false;
+            arg = arg.substr(1);
+        }
+        if(arg.empty()){ //"> file" with a space, the name is the next word
+            if(i + 1 == num_of_args){
+                cerr << "smash error: tee: invalid arguments" << endl;
+                smash.last_status = 1;
+                return;
+            }
+            arg = args[++i];
+        }
+        int fd = _openRedirectTarget(arg.c_str(), append, true);
+        if(fd == -1){
+            perror("smash error: open failed");
+            smash.last_status = 1;
+            continue;
+        }
+        TeeTarget target = {fd, true, {-1, -1}};
+        targets.push_back(target);
+    }
+    if(to_stdout){ //stdout goes first so a regular file, which can always be spliced, ends up last
+        struct stat st;
+        bool spliceable = fstat(STDOUT, &st) == 0 && (S_ISFIFO(st.st_mode) || (S_ISREG(st.st_mode) && !(fcntl(STDOUT, F_GETFL) & O_APPEND)));
+        TeeTarget target = {STDOUT, spliceable, {-1, -1}};
+        targets.insert(targets.begin(), target);
+    }
+    struct stat in_st;
+    bool zero_copy = !targets.empty() && targets.back().spliceable && fstat(STDIN, &in_st) == 0 && S_ISFIFO(in_st.st_mode);
+    int pipe_size = zero_copy ? fcntl(STDIN, F_GETPIPE_SZ) : 0;
+    for(size_t i = 0; zero_copy && i + 1 < targets.size(); i++){
+        if(pipe2(targets[i].mid, O_CLOEXEC) == -1){
+            perror("smash error: pipe failed");
+            smash.last_status = 1;
+            zero_copy = false;
+            break;
+        }
+        //as big as stdin's pipe, so one tee() always fits in whole
+        if(fcntl(targets[i].mid[PIPE_WRITE], F_SETPIPE_SZ, pipe_size) < pipe_size){
+            zero_copy = false;
+        }
+    }
+    if(zero_copy){
+        //every target but the last gets a tee() copy of what sits in stdin's pipe, the last one
+        //consumes it with splice(). the bytes never pass through user space
+        while(true){
+            ssize_t len;
+            if(targets.size() == 1){
+                len = splice(STDIN, nullptr, targets[0].fd, nullptr, pipe_size, SPLICE_F_MOVE);
+                if(len == -1 && errno == EINTR){
+                    continue;
+                }
+                if(len <= 0){
+                    break;
+                }
+                continue;
+            }
+            len = tee(STDIN, targets[0].mid[PIPE_WRITE], pipe_size, 0);
+            if(len == -1 && errno == EINTR){
+                continue;
+            }
+            if(len <= 0){
+                if(len == -1){
+                    perror("smash error: tee failed");
+                    smash.last_status = 1;
+                }
+                break;
+            }
+            bool ok = true;
+            for(size_t i = 1; i + 1 < targets.size(); i++){
+                ok = ok && tee(STDIN, targets[i].mid[PIPE_WRITE], len, 0) == len;
+            }
+            for(size_t i = 0; i + 1 < targets.size(); i++){
+                if(targets[i].spliceable){
+                    ok = _spliceAll(targets[i].mid[PIPE_READ], targets[i].fd, len) && ok;
+                    continue;
+                }
+                char buf[65536]; //a tty can't be spliced to, this target is copied
+                for(ssize_t left = len, bytes; left > 0; left -= bytes){
+                    bytes = read(targets[i].mid[PIPE_READ], buf, min((ssize_t)sizeof(buf), left));
+                    if(bytes <= 0){
+                        ok = false;
+                        break;
+                    }
+                    _writeAll(targets[i].fd, buf, bytes);
+                }
+            }
+            ok = _spliceAll(STDIN, targets.back().fd, len) && ok;
+            if(!ok){
+                perror("smash error: splice failed");
+                smash.last_status = 1;
+                break;
+            }
+        }
+    }
+    else{ //stdin isn't a pipe (or nothing can take a splice), plain copy
+        char buf[65536];
+        ssize_t bytes;
+        while((bytes = read(STDIN, buf, sizeof(buf))) != 0){
+            if(bytes == -1){
+                if(errno == EINTR){
+                    continue;
+                }
+                perror("smash error: read failed");
+                smash.last_status = 1;
+                break;
+            }
+            for(size_t i = 0; i < targets.size(); i++){
+                _writeAll(targets[i].fd, buf, bytes);
+            }
+        }
+    }
+    for(size_t i = 0; i < targets.size(); i++){
+        if(targets[i].mid[PIPE_READ] != -1){
+            close(targets[i].mid[PIPE_READ]);
+            close(targets[i].mid[PIPE_WRITE]);
+        }
+        if(targets[i].fd != STDOUT){
+            close(targets[i].fd);
+        }
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************PMAP***************************************
+****************************************************************************
+***************************************************************************/
+
+#define PMAP_CHUNK_SIZE (1 << 16)
+#define PMAP_MAX_PENDING (1 << 20) //per worker, stop reading stdin while a worker is this far behind
+#define PMAP_MAX_WORKERS (256) //each one costs a process and two pipes
+
+PmapCommand::PmapCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), num_of_workers(0), keep_order(false) {}
+
+struct PmapWorker {
+    pid_t pid;
+    int in_fd; //write end of the worker's stdin
+    int out_fd; //read end of the worker's stdout
+    string pending_in;
+    string partial_out; //output after the last newline seen
+    deque<string> lines_out; //complete lines, only used to keep the order
+};
+
+//setup failed halfway: the workers started so far are killed and reaped, their pipes closed
+static void _abortWorkers(vector<PmapWorker>& workers, int started){
+    for(int w = 0; w < started; w++){
+        close(workers[w].in_fd);
+        close(workers[w].out_fd);
+        kill(workers[w].pid, SIGKILL);
+    }
+    for(int w = 0; w < started; w++){
+        waitpid(workers[w].pid, NULL, 0);
+    }
+}
+
+void PmapCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    int i = 1;
+    for(; i < num_of_args && *args[i] == '-'; i++){
+        if(strcmp(args[i], "-j") == 0 && i + 1 < num_of_args && isdigit(*args[i + 1])){
+            long workers = strtol(args[++i], nullptr, 10);
+            num_of_workers = workers > PMAP_MAX_WORKERS ? -1 : (int)workers;
+        }
+        else if(strcmp(args[i], "-k") == 0){
+            keep_order = true;
+        }
+        else{
+            break;
+        }
+    }
+    worker_cmd = _skipWords(cmd_line, i);
+    if(num_of_workers <= 0 || worker_cmd.empty()){ //-j above PMAP_MAX_WORKERS too
+        cerr << "smash error: pmap: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    //same plumbing as PipeCommand: one pipe pair per copy of the stage, the child sees them as fd 0/1
+    vector<PmapWorker> workers(num_of_workers);
+    for(int w = 0; w < num_of_workers; w++){
+        int in[2], out[2];
+        if(pipe2(in, O_CLOEXEC) == -1){
+            perror("smash error: pipe failed");
+            smash.last_status = 1;
+            _abortWorkers(workers, w);
+            return;
+        }
+        if(pipe2(out, O_CLOEXEC) == -1){
+            perror("smash error: pipe failed");
+            smash.last_status = 1;
+            close(in[PIPE_READ]);
+            close(in[PIPE_WRITE]);
+            _abortWorkers(workers, w);
+            return;
+        }
+        pid_t pid = fork();
+        if(pid == -1){
+            perror("smash error: fork failed");
+            smash.last_status = 1;
+            close(in[PIPE_READ]);
+            close(in[PIPE_WRITE]);
+            close(out[PIPE_READ]);
+            close(out[PIPE_WRITE]);
+            _abortWorkers(workers, w);
+            return;
+        }
+        if(pid == 0){
+            signal(SIGPIPE, SIG_DFL);
+            if(dup2(in[PIPE_READ], STDIN) == -1 || dup2(out[PIPE_WRITE], STDOUT) == -1){
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
+            //any write end left open here, ours or a sibling's, would keep EOF from coming
+            close(in[PIPE_READ]);
+            close(in[PIPE_WRITE]);
+            close(out[PIPE_READ]);
+            close(out[PIPE_WRITE]);
+            for(int prev = 0; prev < w; prev++){
+                close(workers[prev].in_fd);
+                close(workers[prev].out_fd);
+            }
+            smash.executeCommand(worker_cmd.c_str());
+            exit(0);
+        }
+        close(in[PIPE_READ]);
+        close(out[PIPE_WRITE]);
+        fcntl(in[PIPE_WRITE], F_SETFL, O_NONBLOCK);
+        fcntl(out[PIPE_READ], F_SETFL, O_NONBLOCK);
+        workers[w].pid = pid;
+        workers[w].in_fd = in[PIPE_WRITE];
+        workers[w].out_fd = out[PIPE_READ];
+    }
+    //a worker that quits early must not take smash down with SIGPIPE
+    sighandler_t old_sigpipe = signal(SIGPIPE, SIG_IGN);
+    string carry; //input after the last newline, records are never split
+    bool stdin_eof = false;
+    size_t next_in = 0, next_out = 0;
+    int open_outputs = num_of_workers;
+    char buf[PMAP_CHUNK_SIZE];
+    while(open_outputs > 0){
+        vector<struct pollfd> fds;
+        bool backlog = false;
+        for(int w = 0; w < num_of_workers; w++){
+            backlog = backlog || workers[w].pending_in.size() >= PMAP_MAX_PENDING;
+        }
+        if(!stdin_eof && !backlog){
+            struct pollfd pfd = {STDIN, POLLIN, 0};
+            fds.push_back(pfd);
+        }
+        for(int w = 0; w < num_of_workers; w++){
+            if(workers[w].in_fd != -1 && !workers[w].pending_in.empty()){
+                struct pollfd pfd = {workers[w].in_fd, POLLOUT, 0};
+                fds.push_back(pfd);
+            }
+            if(workers[w].out_fd != -1){
+                struct pollfd pfd = {workers[w].out_fd, POLLIN, 0};
+                fds.push_back(pfd);
+            }
+        }
+        if(poll(fds.data(), fds.size(), -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("smash error: poll failed");
+            smash.last_status = 1;
+            break;
+        }
+        for(size_t f = 0; f < fds.size(); f++){
+            if(fds[f].revents == 0){
+                continue;
+            }
+            if(fds[f].fd == STDIN){
+                ssize_t bytes = read(STDIN, buf, sizeof(buf));
+                if(bytes > 0){
+                    carry.append(buf, bytes);
+                }
+                else if(bytes == 0 || errno != EINTR){
+                    stdin_eof = true;
+                    if(!carry.empty() && carry[carry.length() - 1] != '\n'){
+                        carry += '\n';
+                    }
+                }
+                size_t cut = carry.find_last_of('\n');
+                if(cut == string::npos){
+                    continue;
+                }
+                if(keep_order){ //line by line, line k goes to worker k % N and comes back in that order
+                    size_t start = 0;
+                    while(start <= cut){
+                        size_t nl = carry.find('\n', start);
+                        workers[next_in].pending_in.append(carry, start, nl - start + 1);
+                        next_in = (next_in + 1) % num_of_workers;
+                        start = nl + 1;
+                    }
+                }
+                else{ //a whole block of lines per worker
+                    workers[next_in].pending_in.append(carry, 0, cut + 1);
+                    next_in = (next_in + 1) % num_of_workers;
+                }
+                carry.erase(0, cut + 1);
+                continue;
+            }
+            for(int w = 0; w < num_of_workers; w++){
+                PmapWorker& worker = workers[w];
+                if(fds[f].fd == worker.in_fd && (fds[f].events & POLLOUT)){
+                    ssize_t bytes = write(worker.in_fd, worker.pending_in.data(), worker.pending_in.size());
+                    if(bytes > 0){
+                        worker.pending_in.erase(0, bytes);
+                    }
+                    else if(bytes == -1 && errno == EPIPE){
+                        cerr << "smash error: pmap: worker " << worker.pid << " exited early, input dropped" << endl;
+                        smash.last_status = 1;
+                        worker.pending_in.clear();
+                        close(worker.in_fd);
+                        worker.in_fd = -1;
+                    }
+                }
+                else if(fds[f].fd == worker.out_fd && (fds[f].events & POLLIN)){
+                    ssize_t bytes = read(worker.out_fd, buf, sizeof(buf));
+                    if(bytes == -1){
+                        continue;
+                    }
+                    if(bytes == 0){
+                        close(worker.out_fd);
+                        worker.out_fd = -1;
+                        open_outputs--;
+                        if(!worker.partial_out.empty()){
+                            worker.partial_out += '\n';
+                        }
+                    }
+                    worker.partial_out.append(buf, bytes);
+                    size_t cut = worker.partial_out.find_last_of('\n');
+                    if(cut == string::npos){
+                        continue;
+                    }
+                    if(!keep_order){ //whole lines only, so workers never interleave inside a line
+                        _writeAll(STDOUT, worker.partial_out.data(), cut + 1);
+                    }
+                    else{
+                        size_t start = 0;
+                        while(start <= cut){
+                            size_t nl = worker.partial_out.find('\n', start);
+                            worker.lines_out.push_back(worker.partial_out.substr(start, nl - start + 1));
+                            start = nl + 1;
+                        }
+                    }
+                    worker.partial_out.erase(0, cut + 1);
+                }
+            }
+        }
+        if(keep_order){
+            string ready;
+            while(!workers[next_out].lines_out.empty()){
+                ready += workers[next_out].lines_out.front();
+                workers[next_out].lines_out.pop_front();
+                next_out = (next_out + 1) % num_of_workers;
+            }
+            _writeAll(STDOUT, ready.data(), ready.size());
+        }
+        if(stdin_eof && carry.empty()){ //all input handed out, let each worker see EOF once it has it all
+            for(int w = 0; w < num_of_workers; w++){
+                if(workers[w].in_fd != -1 && workers[w].pending_in.empty()){
+                    close(workers[w].in_fd);
+                    workers[w].in_fd = -1;
+                }
+            }
+        }
+    }
+    if(keep_order){ //a filter that didn't answer every line breaks the rotation, flush what is left
+        for(int w = 0; w < num_of_workers; w++){
+            for(size_t l = 0; l < workers[w].lines_out.size(); l++){
+                _writeAll(STDOUT, workers[w].lines_out[l].data(), workers[w].lines_out[l].size());
+            }
+        }
+    }
+    for(int w = 0; w < num_of_workers; w++){
+        if(workers[w].in_fd != -1){
+            close(workers[w].in_fd);
+        }
+        waitpid(workers[w].pid, NULL, 0);
+    }
+    signal(SIGPIPE, old_sigpipe);
+}
+
+/***************************************************************************
+****************************************************************************
+******************************REDIRECTION***********************************
+****************************************************************************
+***************************************************************************/
+
+RedirectionCommand::RedirectionCommand(const char* cmd_line, int pid): Command(cmd_line, true, pid), cmd_str(string(cmd_line)), out_channel(-1),
+                                                                      append(false), rotate(false), rotate_size(100LL << 20), rotate_keep(5) {}
+
+void RedirectionCommand::execute(){ ///needs to use prepare and cleanup
+    SmallShell& smash = SmallShell::getInstance();
+    if(cmd_str.find(">>") != std::string::npos){
+        append = true;
+    }
+    else{ //only <
+        append = false;
+    }
+    size_t arrow_index = cmd_str.find_first_of(">");
+    rotate = cmd_str[arrow_index + 1] == '~';
+    split_cmd();
+    prepare();
+    if(fixed_cmd != ""){
+        smash.executeCommand(fixed_cmd.c_str());
+    }
+    cleanup();
+}
+
+void RedirectionCommand::split_cmd(){
+    SmallShell& smash = SmallShell::getInstance();
+    int arrow_index = cmd_str.find_first_of(">");
+    int file_path_start = arrow_index + (append || rotate ? 2 : 1); //skip >> or >~ instead of >
+    //fixed_cmd = string(cmd_str.begin(), cmd_str.begin()+arrow_index);
+    fixed_cmd = cmd_str.substr(0, arrow_index);
+    //file_path = _trim(string(cmd_str.begin()+file_path_start, cmd_str.end()));
+    file_path = _trim(cmd_str.substr(file_path_start));
+    if(_isBackgroundCommand(file_path.c_str())){ //the & belongs to the command, not to the file name
+        file_path = _rtrim(file_path.substr(0, file_path.length() - 1));
+        fixed_cmd = _rtrim(fixed_cmd) + "&";
+    }
+    file_path = SmallShell::getInstance().expandVariables(file_path);
+    if(rotate){ //file[:size[:generations]]
+        size_t colon = file_path.find(':');
+        if(colon != string::npos){
+            string spec = file_path.substr(colon + 1);
+            file_path = file_path.substr(0, colon);
+            size_t second = spec.find(':');
+            rotate_size = _parseSize(spec.substr(0, second).c_str());
+            rotate_keep = second == string::npos ? rotate_keep : atoi(spec.c_str() + second + 1);
+            if(rotate_size <= 0 || rotate_keep < 0 || (second != string::npos && !is_digits(spec.substr(second + 1)))){
+                cerr << "smash error: invalid rotation spec " << spec << endl;
+                smash.last_status = 1;
+                fixed_cmd = "";
+            }
+        }
+    }
+}
+
+void RedirectionCommand::prepare() {
+    SmallShell& smash = SmallShell::getInstance();
     temp_stdout = dup(STDOUT);
     if(temp_stdout == -1) {
         perror("smash error: dup failed");
+        smash.last_status = 1;
         fixed_cmd = "";
         return;
     }
-    if(append) {
-        out_channel = open(file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-    }
-    else {
-        out_channel = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-    }
+    out_channel = rotate ? startRotator() : _openRedirectTarget(file_path.c_str(), append);
     if(out_channel == -1) {
         perror("smash error: open failed");
+        smash.last_status = 1;
         fixed_cmd = "";// reset command so nothing will happen in execute 
         return;
         //exit(0);
@@ -944,6 +3497,104 @@ void RedirectionCommand::prepare() {
     }
 }
 
+#define ROTATE_BUFFER_SIZE (1 << 20)
+#define ROTATE_FLUSH_MS (500)
+
+//path -> path.1 -> path.2 ... path.keep, the oldest one falls off
+static void _rotateGenerations(const string& path, int keep){
+    if(keep == 0){
+        return;
+    }
+    for(int gen = keep - 1; gen >= 1; gen--){
+        rename((path + "." + std::to_string(gen)).c_str(), (path + "." + std::to_string(gen + 1)).c_str());
+    }
+    rename(path.c_str(), (path + ".1").c_str());
+}
+
+/**
+* Starts the process that owns the log file for cmd >~ file:size:keep and returns the write end of
+* its pipe. it collects the output into big writes and rotates when the cap is hit, so the job
+* itself never stops and nobody has to copytruncate. it exits when the last writer is gone
+*/
+int RedirectionCommand::startRotator() {
+    SmallShell& smash = SmallShell::getInstance();
+    int fd[2];
+    if(pipe2(fd, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    pid_t pid = _forkDetached();
+    if(pid == -1) {
+        close(fd[PIPE_READ]);
+        close(fd[PIPE_WRITE]);
+        return -1;
+    }
+    if(pid > 0) {
+        close(fd[PIPE_READ]);
+        return fd[PIPE_WRITE];
+    }
+    close(fd[PIPE_WRITE]);
+    close(temp_stdout);
+    int out = open(file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(out == -1) {
+        perror("smash error: open failed");
+        smash.last_status = 1;
+        _exit(1);
+    }
+    struct stat st;
+    long long size = fstat(out, &st) == 0 ? st.st_size : 0;
+    vector<char> buffer(ROTATE_BUFFER_SIZE);
+    size_t used = 0;
+    bool eof = false;
+    while(!eof) {
+        struct pollfd pfd = {fd[PIPE_READ], POLLIN, 0};
+        int ready = poll(&pfd, 1, used > 0 ? ROTATE_FLUSH_MS : -1); //a quiet job still gets its output on disk
+        if(ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if(ready > 0) {
+            ssize_t bytes = read(fd[PIPE_READ], buffer.data() + used, buffer.size() - used);
+            if(bytes == -1 && errno == EINTR) {
+                continue;
+            }
+            eof = bytes <= 0;
+            used += bytes > 0 ? bytes : 0;
+            if(!eof && used < buffer.size()) {
+                continue;
+            }
+        }
+        size_t done = 0;
+        while(done < used) {
+            if(size >= rotate_size) {
+                close(out);
+                _rotateGenerations(file_path, rotate_keep);
+                out = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+                if(out == -1) {
+                    perror("smash error: open failed");
+                    smash.last_status = 1;
+                    _exit(1);
+                }
+                size = 0;
+            }
+            //fill up to the cap. when the rest doesn't fit, end this file after the last full line
+            size_t left = used - done;
+            size_t chunk = min((long long)left, rotate_size - size);
+            bool full = chunk < left;
+            if(full) {
+                const char* nl = (const char*)memrchr(buffer.data() + done, '\n', chunk);
+                if(nl != nullptr) {
+                    chunk = nl - (buffer.data() + done) + 1;
+                }
+            }
+            _writeAll(out, buffer.data() + done, chunk);
+            done += chunk;
+            size = full ? rotate_size : size + chunk;
+        }
+        used = 0;
+    }
+    close(out);
+    _exit(0);
+}
+
 void RedirectionCommand::cleanup() {
     if(dup2(temp_stdout, STDOUT) == -1) {  // returns stdout to channel 1
         perror("smash error: dup2 failed");
@@ -959,6 +3610,147 @@ void RedirectionCommand::cleanup() {
     }
 }
 
+/***************************************************************************
+****************************************************************************
+**************************INPUT_REDIRECTION*********************************
+****************************************************************************
+***************************************************************************/
+
+InputRedirectionCommand::InputRedirectionCommand(const char* cmd_line, int pid): Command(cmd_line, true, pid), cmd_str(string(cmd_line)),
+                                                                                here(false), in_channel(-1), temp_stdin(-1) {}
+
+void InputRedirectionCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    split_cmd();
+    prepare();
+    if(fixed_cmd != ""){
+        smash.executeCommand(fixed_cmd.c_str()); //forked children inherit the file as fd 0
+    }
+    cleanup();
+}
+
+/**
+* Cuts the redirection out of the line, wherever it is: cmd < in > out and cmd > out < in both work.
+* for << the body lines are read right here from smash's input, up to the delimiter line.
+* $NAME in the body (or in a <<< word) is expanded unless the delimiter (or word) is quoted
+*/
+void InputRedirectionCommand::split_cmd(){
+    SmallShell& smash = SmallShell::getInstance();
+    size_t less = cmd_str.find("<<");
+    if(less == string::npos || cmd_str.compare(less, 3, "<<<") == 0){ //a here-doc anywhere wins, its body must be read
+        less = cmd_str.find('<');
+    }
+    int arrows = cmd_str.compare(less, 3, "<<<") == 0 ? 3 : cmd_str.compare(less, 2, "<<") == 0 ? 2 : 1;
+    bool strip_tabs = arrows == 2 && cmd_str[less + 2] == '-'; //<<- drops the leading tabs of the body
+    size_t start = cmd_str.find_first_not_of(WHITESPACE, less + arrows + (strip_tabs ? 1 : 0));
+    if(start == string::npos){
+        cerr << "smash error: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    size_t end;
+    string word;
+    bool quoted = cmd_str[start] == '\'' || cmd_str[start] == '"';
+    if(quoted){
+        end = cmd_str.find(cmd_str[start], start + 1);
+        if(end == string::npos){
+            cerr << "smash error: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        word = cmd_str.substr(start + 1, end - start - 1);
+        end++;
+    }
+    else{
+        end = cmd_str.find_first_of(WHITESPACE + "<>|&", start);
+        end = end == string::npos ? cmd_str.length() : end;
+        word = cmd_str.substr(start, end - start);
+    }
+    here = arrows > 1;
+    if(arrows == 1){
+        file_path = smash.expandVariables(word);
+    }
+    else if(arrows == 3){
+        here_body = (quoted && cmd_str[start] == '\'' ? word : smash.expandVariables(word)) + "\n";
+    }
+    else{
+        string line;
+        while(getline(cin, line)){
+            if(strip_tabs){
+                line.erase(0, line.find_first_not_of('\t'));
+            }
+            if(line == word){
+                break;
+            }
+            here_body += quoted ? line : smash.expandVariables(line);
+            here_body += '\n';
+        }
+        if(less > cmd_str.find('|')){ //a later stage's child can't read the body, it was consumed here so it isn't run as commands
+            cerr << "smash error: here-document is only supported before the first |" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    string before = _trim(cmd_str.substr(0, less));
+    string after = _trim(cmd_str.substr(end));
+    fixed_cmd = after.empty() ? before : before + " " + after;
+}
+
+//a memfd holding body, sealed so nothing can change it under the reader, positioned at the start
+static int _sealedMemfd(const string& body){
+    int fd = memfd_create("smash-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd == -1){
+        perror("smash error: memfd_create failed");
+        return -1;
+    }
+    if(!_writeAll(fd, body.data(), body.size())){ //memory, never waits for a reader however big the body is
+        perror("smash error: write failed");
+        close(fd);
+        return -1;
+    }
+    if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1){
+        perror("smash error: fcntl failed");
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+void InputRedirectionCommand::prepare() {
+    SmallShell& smash = SmallShell::getInstance();
+    if(fixed_cmd == ""){
+        return;
+    }
+    in_channel = here ? _sealedMemfd(here_body) : open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in_channel == -1) {
+        if(!here) {
+            perror("smash error: open failed");
+            smash.last_status = 1;
+        }
+        fixed_cmd = "";
+        return;
+    }
+    here_body.clear();
+    temp_stdin = dup(STDIN);
+    if(temp_stdin == -1 || dup2(in_channel, STDIN) == -1) { //dup2 leaves fd 0 without O_CLOEXEC
+        perror("smash error: dup2 failed");
+        smash.last_status = 1;
+        fixed_cmd = "";
+    }
+}
+
+void InputRedirectionCommand::cleanup() {
+    if(temp_stdin != -1) {
+        if(dup2(temp_stdin, STDIN) == -1) { //smash reads its commands from fd 0 again
+            perror("smash error: dup2 failed");
+            exit(0);
+        }
+        close(temp_stdin);
+    }
+    if(in_channel != -1) {
+        close(in_channel);
+    }
+}
+
 /***************************************************************************
 ****************************************************************************
 *******************************SET_CORE***********************************
@@ -973,19 +3765,23 @@ void SetcoreCommand::execute(){
     int core_num, job_id;
     if(num_of_args != 3){
         cerr << "smash error: setcore: invalid arguments" << endl;
+        smash.last_status = 1;
         return;
     }
     if(!is_digits(args[1])){ //should be job id
         cerr << "smash error: setcore: job-id " << *args[1] <<  " does not exist" << endl;
+        smash.last_status = 1;
         return;
     }
     job_id = atoi(args[1]);
     if(smash.Jobs_List->getJobById(job_id) == nullptr){
         cerr << "smash error: setcore: job-id " << job_id << " does not exist" << endl;
+        smash.last_status = 1;
         return;
     }
     if(!is_digits(args[2])){ //should be core num
         cerr << "smash error: setcore: invalid core number" << endl;
+        smash.last_status = 1;
         return;
     }
     core_num = atoi(args[2]);
@@ -993,6 +3789,7 @@ void SetcoreCommand::execute(){
     ulong num_of_cores = sysconf(_SC_NPROCESSORS_CONF);
     if (core_num > num_of_cores - 1 || core_num < 0) {
         cerr << "smash error: setcore: invalid core number" << endl;
+        smash.last_status = 1;
         return;
     }
     JobsList::JobEntry* job = smash.Jobs_List->getJobById(job_id);
@@ -1002,6 +3799,7 @@ void SetcoreCommand::execute(){
     if (sched_setaffinity(job->process_id, sizeof(cpu_set_t), &my_set) == -1)
     {
         perror("smash error: sched_setaffinity failed");
+        smash.last_status = 1;
         return;
     }
     ///I think this should end it...
@@ -1009,70 +3807,1712 @@ void SetcoreCommand::execute(){
 
 /***************************************************************************
 ****************************************************************************
-*************************EXTERNAL_COMMANDS**********************************
+**********************************TAIL**************************************
 ****************************************************************************
 ***************************************************************************/
 
-ExternalCommand::ExternalCommand(const char* cmd_line, int pid) : Command(cmd_line, false, pid) {
-    is_in_bg = _isBackgroundCommand(cmd_line); //this field is from the general Command
+TailCommand::TailCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), num_of_lines(10), follow(false), follow_name(false) {
+    is_in_bg = _isBackgroundCommand(cmd_line);
 }
 
-void ExternalCommand::execute() { //need to check if simple or complex...
-    SmallShell& smash = SmallShell::getInstance();
-    bool is_spaced = false;
-    if(*args[num_of_args-1] == '&'){
-        is_spaced = true;
+#define TAIL_BLOCK (65536)
+
+//where the last num_of_lines lines of data start, walking backwards from the end with memrchr
+static size_t _tailStart(const char* data, size_t size, int num_of_lines){
+    if(size == 0 || num_of_lines <= 0){
+        return size;
     }
-    _removeGivenSign(cmd_line, '&');
-    if(is_spaced){
-        num_of_args--;
-        args[num_of_args] = nullptr;
+    size_t end = size;
+    if(data[end - 1] == '\n'){ //the last newline terminates the last line, it doesn't start one
+        end--;
     }
-    bool bg = is_in_bg;
-    Command* cmd = smash.CreateCommand(orig_cmd_line);
-    cmd->is_in_bg = bg;
-    if (!is_in_bg)
-    {
-        smash.fg_cmd = cmd;
+    int found = 0;
+    while(end > 0){
+        const char* nl = (const char*)memrchr(data, '\n', end);
+        if(nl == nullptr){
+            break;
+        }
+        if(++found == num_of_lines){
+            return nl - data + 1;
+        }
+        end = nl - data;
     }
-    pid_t pid = fork();
-    if(pid == -1) {
-        perror("smash error: fork failed");
-        return;
+    return 0;
+}
+
+//the same for a regular file of the given size, read backwards one block at a time with pread,
+//so only the blocks holding the last lines are read and nothing is mapped that could shrink
+static off_t _tailOffset(int fd, off_t size, int num_of_lines){
+    if(num_of_lines <= 0){
+        return size;
     }
-    if(pid == 0) {  /// child
-        setpgrp();
-        int child_pid = getpid();
-        if(is_complex_command(cmd_line)) { //complex command
-            if(execl("/bin/bash", "/bin/bash", "-c",(string(cmd_line)).c_str() , nullptr) == -1) {
-                perror("smash error: execl failed");
-                return;
-            }
+    char buf[TAIL_BLOCK];
+    off_t end = size;
+    int found = 0;
+    while(end > 0){
+        off_t begin = end > TAIL_BLOCK ? end - TAIL_BLOCK : 0;
+        ssize_t bytes = pread(fd, buf, end - begin, begin);
+        if(bytes != end - begin){ //truncated meanwhile, print whatever is left from here
+            return begin;
         }
-        else { //simple command
-            _removeGivenSign(args[num_of_args - 1], '&');
-            if (execvp(args[0], &args[0]) == -1) {
-                perror("smash error: execvp failed");
-                return;
+        size_t len = bytes;
+        if(end == size && buf[len - 1] == '\n'){
+            len--;
+        }
+        const char* nl;
+        while((nl = (const char*)memrchr(buf, '\n', len)) != nullptr){
+            if(++found == num_of_lines){
+                return begin + (nl - buf) + 1;
             }
+            len = nl - buf;
         }
+        end = begin;
     }
-    else ///parent
-    {
-        if (!is_in_bg) {
-            cmd->pid = pid;
-            smash.fg_cmd = cmd;
-            int waited = waitpid(pid, NULL, WUNTRACED);
-            if (waited == -1) {
-                perror("smash error: waitpid failed");
-                return;
+    return 0;
+}
+
+/**
+* Prints the last lines of fd and returns the offset where printing stopped, -1 on an error.
+* a regular file is read backwards from its size. anything else (a pipe, or a file that reports
+* no size like the ones in /proc) is read through once, keeping only what can still be the last lines
+*/
+static off_t _printTail(int fd, int num_of_lines){
+    char buf[TAIL_BLOCK];
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0){
+        off_t offset = _tailOffset(fd, st.st_size, num_of_lines);
+        while(offset < st.st_size){
+            ssize_t bytes = pread(fd, buf, min((off_t)sizeof(buf), st.st_size - offset), offset);
+            if(bytes <= 0){
+                break;
             }
-        } else {
-            cmd->pid = pid;
-            smash.Jobs_List->addJob(cmd, BACKGROUND, smash.fg_cmd_job_id);
+            if(!_writeAll(STDOUT, buf, bytes)){
+                perror("smash error: write failed");
+                return -1;
+            }
+            offset += bytes;
         }
+        lseek(fd, offset, SEEK_SET); //consumed, like reading it would
+        return offset;
+    }
+    string kept;
+    off_t total = 0;
+    ssize_t bytes;
+    while((bytes = read(fd, buf, sizeof(buf))) != 0){
+        if(bytes == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("smash error: read failed");
+            return -1;
+        }
+        total += bytes;
+        kept.append(buf, bytes);
+        if(kept.size() > 16 * TAIL_BLOCK){ //later input only moves the start forward
+            kept.erase(0, _tailStart(kept.data(), kept.size(), num_of_lines));
+        }
+    }
+    size_t start = _tailStart(kept.data(), kept.size(), num_of_lines);
+    if(!_writeAll(STDOUT, kept.data() + start, kept.size() - start)){
+        perror("smash error: write failed");
+        return -1;
+    }
+    return total;
+}
+
+void TailCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    int i = 1;
+    for(; i < num_of_args && *args[i] == '-' && strlen(args[i]) > 1; i++){
+        if(strcmp(args[i], "-f") == 0){
+            follow = true;
+        }
+        else if(strcmp(args[i], "-F") == 0){
+            follow = true;
+            follow_name = true;
+        }
+        else if(is_digits(args[i] + 1) && args[i][1] != '-'){
+            num_of_lines = atoi(args[i] + 1);
+        }
+        else{
+            cerr << "smash error: tail: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    for(; i < num_of_args; i++){
+        files.push_back(args[i]);
+    }
+    if((follow && files.empty()) || (!follow && files.size() > 1)){
+        cerr << "smash error: tail: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    if(follow){ //follow mode never ends by itself, it runs as a job so fg/bg/kill control it
+        launchForked();
+        return;
+    }
+    int fd = files.empty() ? STDIN : open(files[0].c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        perror("smash error: open failed");
+        smash.last_status = 1;
+        return;
+    }
+    if(_printTail(fd, num_of_lines) == -1){
+        smash.last_status = 1;
+    }
+    if(fd != STDIN){
+        close(fd);
+    }
+}
+
+struct FollowedFile {
+    string path;
+    int fd;
+    int wd;
+    off_t offset;
+    ino_t inode;
+};
+
+//prints a ==> file <== header whenever the output switches to another file
+static void _followHeader(const vector<FollowedFile>& followed, size_t idx, int& last_printed){
+    if(followed.size() > 1 && last_printed != (int)idx){
+        string header = (last_printed == -1 ? "" : "\n") + string("==> ") + followed[idx].path + " <==\n";
+        _writeAll(STDOUT, header.c_str(), header.length());
+    }
+    last_printed = idx;
+}
+
+//copies whatever was appended since the last read with pread, nothing is re-read
+static void _followDrain(vector<FollowedFile>& followed, size_t idx, int& last_printed){
+    FollowedFile& file = followed[idx];
+    struct stat st;
+    if(file.fd == -1 || fstat(file.fd, &st) == -1){
+        return;
+    }
+    if(st.st_size < file.offset){
+        cerr << "smash: tail: " << file.path << ": file truncated" << endl;
+        file.offset = 0;
+    }
+    char buf[65536];
+    while(file.offset < st.st_size){
+        ssize_t bytes = pread(file.fd, buf, sizeof(buf), file.offset);
+        if(bytes <= 0){
+            break;
+        }
+        _followHeader(followed, idx, last_printed);
+        _writeAll(STDOUT, buf, bytes);
+        file.offset += bytes;
+    }
+}
+
+static bool _followOpen(FollowedFile& file, int inotify_fd){
+    file.fd = open(file.path.c_str(), O_RDONLY);
+    if(file.fd == -1){
+        return false;
+    }
+    struct stat st;
+    fstat(file.fd, &st);
+    file.inode = st.st_ino;
+    if(inotify_fd != -1){
+        file.wd = inotify_add_watch(inotify_fd, file.path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    }
+    return true;
+}
+
+void TailCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    vector<FollowedFile> followed;
+    int last_printed = -1;
+    //inotify wakes us on every write. without it we fall back to checking once a second
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(inotify_fd != -1 && epoll_fd != -1){
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = inotify_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ev);
+    }
+    else if(inotify_fd != -1){
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    for(size_t i = 0; i < files.size(); i++){
+        FollowedFile file = {files[i], -1, -1, 0, 0};
+        if(!_followOpen(file, inotify_fd)){
+            if(!follow_name){
+                perror("smash error: open failed");
+                smash.last_status = 1;
+                continue;
+            }
+            cerr << "smash: tail: cannot open " << file.path << ", waiting for it to appear" << endl;
+        }
+        if(follow_name && inotify_fd != -1){ //rotation shows up as a create/rename in the directory
+            size_t slash = file.path.find_last_of('/');
+            string dir = slash == string::npos ? "." : (slash == 0 ? "/" : file.path.substr(0, slash));
+            inotify_add_watch(inotify_fd, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+        }
+        followed.push_back(file);
+    }
+    if(followed.empty()){
+        exit(1);
+    }
+    for(size_t i = 0; i < followed.size(); i++){
+        if(followed[i].fd == -1){
+            continue;
+        }
+        _followHeader(followed, i, last_printed);
+        followed[i].offset = max(_printTail(followed[i].fd, num_of_lines), (off_t)0);
+    }
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        if(inotify_fd != -1){
+            struct epoll_event ev;
+            if(epoll_wait(epoll_fd, &ev, 1, -1) == -1){
+                continue;
+            }
+            while(read(inotify_fd, events, sizeof(events)) > 0){} //the events only tell us to look again
+        }
+        else{
+            sleep(1);
+        }
+        for(size_t i = 0; i < followed.size(); i++){
+            _followDrain(followed, i, last_printed);
+            if(!follow_name){
+                continue;
+            }
+            struct stat st;
+            bool exists = stat(followed[i].path.c_str(), &st) == 0;
+            if(exists && (followed[i].fd == -1 || st.st_ino != followed[i].inode)){
+                if(followed[i].fd != -1){
+                    if(inotify_fd != -1){
+                        inotify_rm_watch(inotify_fd, followed[i].wd);
+                    }
+                    close(followed[i].fd);
+                }
+                if(_followOpen(followed[i], inotify_fd)){
+                    cerr << "smash: tail: " << followed[i].path << " has been replaced; following new file" << endl;
+                    followed[i].offset = 0;
+                    _followDrain(followed, i, last_printed);
+                }
+            }
+        }
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************WATCH**************************************
+****************************************************************************
+***************************************************************************/
+
+WatchCommand::WatchCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), interval(2), diff(false), until_change(false) {
+    is_in_bg = _isBackgroundCommand(cmd_line);
+}
+
+void WatchCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    int i = 1;
+    for(; i < num_of_args && *args[i] == '-'; i++){
+        if(strcmp(args[i], "-n") == 0 && i + 1 < num_of_args){
+            char* end;
+            interval = strtod(args[++i], &end);
+            if(*end != '\0' || !(interval > 0)){
+                cerr << "smash error: watch: invalid arguments" << endl;
+                smash.last_status = 1;
+                return;
+            }
+        }
+        else if(strcmp(args[i], "--diff") == 0){
+            diff = true;
+        }
+        else if(strcmp(args[i], "--until-change") == 0){
+            until_change = true;
+        }
+        else{
+            cerr << "smash error: watch: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    watched_cmd = _skipWords(cmd_line, i);
+    if(is_in_bg){ //the & backgrounds watch itself, each run is waited for
+        watched_cmd = _rtrim(watched_cmd.substr(0, watched_cmd.find_last_of('&')));
+    }
+    if(watched_cmd.empty()){
+        cerr << "smash error: watch: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    launchForked();
+}
+
+//the lines of after that differ from the same line of before, as -old/+new pairs
+static string _lineDiff(const string& before, const string& after){
+    istringstream old_lines(before), new_lines(after);
+    string result, old_line, new_line;
+    while(true){
+        bool has_old = (bool)getline(old_lines, old_line);
+        bool has_new = (bool)getline(new_lines, new_line);
+        if(!has_old && !has_new){
+            return result;
+        }
+        if(has_old && has_new && old_line == new_line){
+            continue;
+        }
+        if(has_old){
+            result += "-" + old_line + "\n";
+        }
+        if(has_new){
+            result += "+" + new_line + "\n";
+        }
+    }
+}
+
+/**
+* Runs on a periodic timerfd, so the schedule doesn't drift with how long a run takes. a run that
+* overruns its slot just makes the next read return several expirations, which start one run,
+* never overlapping ones. each run goes through executeCommand with stdout on a memfd
+*/
+void WatchCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int capture = memfd_create("smash-watch", MFD_CLOEXEC);
+    int out = dup(STDOUT);
+    if(timer == -1 || capture == -1 || out == -1){
+        perror("smash error: watch failed");
+        smash.last_status = 1;
+        return;
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = (time_t)interval;
+    spec.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = 1; //first run right away
+    if(timerfd_settime(timer, 0, &spec, nullptr) == -1){
+        perror("smash error: timerfd_settime failed");
+        smash.last_status = 1;
+        return;
+    }
+    string previous, current;
+    bool first_run = true;
+    while(true){
+        uint64_t expirations;
+        if(read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("smash error: read failed");
+            smash.last_status = 1;
+            return;
+        }
+        if(ftruncate(capture, 0) == -1 || lseek(capture, 0, SEEK_SET) == -1 || dup2(capture, STDOUT) == -1){
+            perror("smash error: watch failed");
+            smash.last_status = 1;
+            return;
+        }
+        smash.executeCommand(watched_cmd.c_str());
+        cout.flush();
+        dup2(out, STDOUT);
+        struct stat st;
+        current.resize(fstat(capture, &st) == 0 ? st.st_size : 0);
+        if(pread(capture, &current[0], current.size(), 0) != (ssize_t)current.size()){
+            current.clear();
+        }
+        if(!first_run && current == previous){
+            continue;
+        }
+        string shown = (diff && !first_run) ? _lineDiff(previous, current) : current;
+        _writeAll(STDOUT, shown.data(), shown.size());
+        if(until_change && !first_run){
+            return;
+        }
+        previous.swap(current);
+        first_run = false;
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************TOUCH**************************************
+****************************************************************************
+***************************************************************************/
+
+TouchCommand::TouchCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid) {}
+
+//accepts @<epoch>, YYYY-MM-DD, YYYY-MM-DDTHH:MM:SS and the ss:mm:hh:dd:mm:yyyy format
+bool _parseTimestamp(const char* str, struct timespec& ts){
+    if(*str == '@' && is_digits(str + 1) && str[1] != '\0'){
+        ts.tv_sec = atol(str + 1);
+        ts.tv_nsec = 0;
+        return true;
+    }
+    const char* formats[] = {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d", "%S:%M:%H:%d:%m:%Y"};
+    for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++){
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(str, formats[i], &tm);
+        if(end != nullptr && *end == '\0'){
+            tm.tm_isdst = -1;
+            ts.tv_sec = mktime(&tm);
+            ts.tv_nsec = 0;
+            return ts.tv_sec != -1;
+        }
+    }
+    return false;
+}
+
+void TouchCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    //one timestamp pair for every file, UTIME_NOW lets the kernel stamp them
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = 0;
+    times[0].tv_nsec = times[1].tv_nsec = UTIME_NOW;
+    int i = 1;
+    for(; i < num_of_args && *args[i] == '-'; i++){
+        if(i + 1 >= num_of_args){
+            cerr << "smash error: touch: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        if(strcmp(args[i], "-d") == 0){
+            if(!_parseTimestamp(args[++i], times[0])){
+                cerr << "smash error: touch: invalid date " << args[i] << endl;
+                smash.last_status = 1;
+                return;
+            }
+            times[1] = times[0];
+        }
+        else if(strcmp(args[i], "-r") == 0){
+            struct stat st;
+            if(stat(args[++i], &st) == -1){
+                perror("smash error: stat failed");
+                smash.last_status = 1;
+                return;
+            }
+            times[0] = st.st_atim;
+            times[1] = st.st_mtim;
+        }
+        else{
+            cerr << "smash error: touch: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    if(i == num_of_args){
+        cerr << "smash error: touch: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    for(; i < num_of_args; i++){
+        if(utimensat(AT_FDCWD, args[i], times, 0) == 0){
+            continue;
+        }
+        if(errno != ENOENT){
+            perror("smash error: utimensat failed");
+            smash.last_status = 1;
+            continue;
+        }
+        //doesn't exist yet, create it and stamp it through the fd
+        int fd = open(args[i], O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+        if(fd == -1){
+            perror("smash error: open failed");
+            smash.last_status = 1;
+            continue;
+        }
+        if(futimens(fd, times) == -1){
+            perror("smash error: futimens failed");
+            smash.last_status = 1;
+        }
+        close(fd);
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+**********************************CAT***************************************
+****************************************************************************
+***************************************************************************/
+
+CatCommand::CatCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid) {}
+
+/**
+* Copies in_fd to out_fd inside the kernel: sendfile from a file, splice when one side is a pipe,
+* and plain read/write only when neither is possible (e.g. a tty on both ends)
+*/
+bool _copyFd(int in_fd, int out_fd){
+    ssize_t moved;
+    while((moved = sendfile(out_fd, in_fd, nullptr, 1 << 30)) > 0) {}
+    if(moved == 0){
+        return true;
+    }
+    if(errno != EINVAL && errno != ENOSYS){
+        return false;
+    }
+    while((moved = splice(in_fd, nullptr, out_fd, nullptr, 1 << 20, SPLICE_F_MOVE)) > 0) {}
+    if(moved == 0){
+        return true;
+    }
+    if(errno != EINVAL && errno != ENOSYS){
+        return false;
+    }
+    char buf[65536];
+    while((moved = read(in_fd, buf, sizeof(buf))) > 0){
+        if(!_writeAll(out_fd, buf, moved)){
+            return false;
+        }
+    }
+    return moved == 0;
+}
+
+//cat, head and wc run in-process, except that reading the terminal would hold the shell, so that
+//becomes a job ctrl-C/ctrl-Z can reach
+void CatCommand::execute(){
+    _removeBackgroundArg(args, num_of_args);
+    if(num_of_args == 1 && isatty(STDIN)){
+        launchForked();
+        return;
+    }
+    childMain();
+}
+
+void CatCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    if(num_of_args == 1){
+        if(!_copyFd(STDIN, STDOUT)){
+            perror("smash error: cat failed");
+            smash.last_status = 1;
+        }
+        return;
+    }
+    for(int i = 1; i < num_of_args; i++){
+        int fd = open(args[i], O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            perror("smash error: open failed");
+            smash.last_status = 1;
+            continue;
+        }
+        if(!_copyFd(fd, STDOUT)){
+            perror("smash error: cat failed");
+            smash.last_status = 1;
+        }
+        close(fd);
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+**********************************HEAD**************************************
+****************************************************************************
+***************************************************************************/
+
+HeadCommand::HeadCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), num_of_lines(10), path(nullptr) {}
+
+void HeadCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    int i = 1;
+    if(num_of_args > 1 && *args[1] == '-'){
+        if(!is_digits(args[1] + 1) || args[1][1] == '\0' || args[1][1] == '-'){
+            cerr << "smash error: head: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        num_of_lines = atoi(args[1] + 1);
+        i++;
+    }
+    if(num_of_args > i + 1){
+        cerr << "smash error: head: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    path = i < num_of_args ? args[i] : nullptr;
+    if(path == nullptr && isatty(STDIN)){
+        launchForked();
+        return;
+    }
+    childMain();
+}
+
+void HeadCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    int fd = STDIN;
+    if(path != nullptr){
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            perror("smash error: open failed");
+            smash.last_status = 1;
+            return;
+        }
+    }
+    //each chunk is written up to where the lines run out, and nothing after that is read
+    int left = num_of_lines;
+    bool written = left == 0 || _readChunks(fd, [&](const char* data, size_t size){
+        size_t end = 0;
+        while(left > 0 && end < size){
+            const char* nl = (const char*)memchr(data + end, '\n', size - end);
+            end = nl == nullptr ? size : nl - data + 1;
+            left -= nl != nullptr;
+        }
+        if(!_writeAll(STDOUT, data, end)){
+            perror("smash error: write failed");
+            smash.last_status = 1;
+            return false;
+        }
+        return left > 0;
+    });
+    if(!written){
+        smash.last_status = 1;
+    }
+    if(fd != STDIN){
+        close(fd);
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+***********************************WC***************************************
+****************************************************************************
+***************************************************************************/
+
+WcCommand::WcCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), lines(false), words(false), bytes(false) {}
+
+//16 bytes per compare with SSE2, the tail (or a build without SSE2) goes byte by byte
+size_t _countNewlines(const char* data, size_t size){
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= size; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    }
+#endif
+    for(; i < size; i++){
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+//in_word carries a word that runs over the end of one chunk into the next
+size_t _countWords(const char* data, size_t size, bool& in_word){
+    size_t count = 0;
+    for(size_t i = 0; i < size; i++){
+        bool space = isspace((unsigned char)data[i]);
+        count += !space && !in_word;
+        in_word = !space;
+    }
+    return count;
+}
+
+void WcCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    for(int i = 1; i < num_of_args; i++){
+        if(*args[i] == '-' && args[i][1] != '\0'){
+            for(const char* opt = args[i] + 1; *opt; opt++){
+                if(*opt == 'l') lines = true;
+                else if(*opt == 'w') words = true;
+                else if(*opt == 'c') bytes = true;
+                else{
+                    cerr << "smash error: wc: invalid arguments" << endl;
+                    smash.last_status = 1;
+                    return;
+                }
+            }
+        }
+        else{
+            paths.push_back(args[i]);
+        }
+    }
+    if(paths.empty()){
+        paths.push_back(nullptr); //stdin
+    }
+    if(!lines && !words && !bytes){
+        lines = words = bytes = true;
+    }
+    if(paths[0] == nullptr && isatty(STDIN)){
+        launchForked();
+        return;
+    }
+    childMain();
+}
+
+void WcCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    vector<vector<size_t> > rows;
+    vector<string> names;
+    size_t total[3] = {0, 0, 0};
+    for(size_t i = 0; i < paths.size(); i++){
+        size_t counts[3] = {0, 0, 0}; //lines, words, bytes
+        bool in_word = false;
+        auto count = [&](const char* data, size_t size){
+            if(lines) counts[0] += _countNewlines(data, size);
+            if(words) counts[1] += _countWords(data, size, in_word);
+            counts[2] += size;
+            return true;
+        };
+        int fd = STDIN;
+        if(paths[i] != nullptr){
+            fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+            if(fd == -1){
+                perror("smash error: open failed");
+                smash.last_status = 1;
+                continue;
+            }
+        }
+        struct stat st;
+        bool read_ok;
+        if(!lines && !words && fd != STDIN && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+            counts[2] = st.st_size; //the size is known without reading anything
+            read_ok = true;
+        }
+        else{ //counted chunk by chunk as it arrives
+            read_ok = _readChunks(fd, count);
+        }
+        if(fd != STDIN){
+            close(fd);
+        }
+        if(!read_ok){
+            smash.last_status = 1;
+            continue;
+        }
+        vector<size_t> row;
+        if(lines) row.push_back(counts[0]);
+        if(words) row.push_back(counts[1]);
+        if(bytes) row.push_back(counts[2]);
+        for(size_t j = 0; j < row.size(); j++){
+            total[j] += row[j];
+        }
+        rows.push_back(row);
+        names.push_back(paths[i] == nullptr ? "" : paths[i]);
+    }
+    if(rows.empty()){
+        return;
+    }
+    if(rows.size() > 1){
+        rows.push_back(vector<size_t>(total, total + rows[0].size()));
+        names.push_back("total");
+    }
+    //like coreutils, a lone number isn't padded, otherwise columns are as wide as the biggest one
+    int width = 1;
+    if(rows.size() > 1 || rows[0].size() > 1){
+        for(size_t j = 0; j < rows.back().size(); j++){
+            width = max(width, (int)std::to_string(rows.back()[j]).length());
+        }
+    }
+    ostringstream out;
+    for(size_t i = 0; i < rows.size(); i++){
+        for(size_t j = 0; j < rows[i].size(); j++){
+            out << (j ? " " : "") << setw(width) << rows[i][j];
+        }
+        out << (names[i].empty() ? "" : " ") << names[i] << "\n";
+    }
+    string str = out.str();
+    _writeAll(STDOUT, str.c_str(), str.length());
+}
+
+/***************************************************************************
+****************************************************************************
+***********************************CP***************************************
+****************************************************************************
+***************************************************************************/
+
+#define CP_BUFFER_SIZE (1 << 20)
+#define CP_BUFFER_ALIGN (4096)
+
+CpCommand::CpCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid) {}
+
+/**
+* Copies src over dst and returns the bytes copied or -1. tries the cheapest way first: a reflink
+* (FICLONE, no data moves at all), then copy_file_range (in the kernel, offloaded by NFS/SMB
+* servers), and only then a read/write loop through one page aligned buffer
+*/
+long long _copyFile(const string& src, const string& dst){
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in == -1){
+        perror("smash error: open failed");
+        return -1;
+    }
+    struct stat st, dst_st;
+    if(fstat(in, &st) == -1){
+        perror("smash error: fstat failed");
+        close(in);
+        return -1;
+    }
+    if(S_ISDIR(st.st_mode)){
+        cerr << "smash error: cp: " << src << " is a directory" << endl;
+        close(in);
+        return -1;
+    }
+    //O_TRUNC on the source itself would empty it before anything is read
+    if(stat(dst.c_str(), &dst_st) == 0 && dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino){
+        cerr << "smash error: cp: " << src << " and " << dst << " are the same file" << endl;
+        close(in);
+        return -1;
+    }
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if(out == -1){
+        perror("smash error: open failed");
+        close(in);
+        return -1;
+    }
+    long long copied = 0;
+    if(ioctl(out, FICLONE, in) == 0){
+        copied = st.st_size;
+    }
+    else{
+        ssize_t moved;
+        while((moved = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0)) > 0){
+            copied += moved;
+        }
+        if(moved == -1 && copied == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)){
+            void* buf = nullptr;
+            if(posix_memalign(&buf, CP_BUFFER_ALIGN, CP_BUFFER_SIZE) != 0){
+                moved = -1;
+            }
+            else{
+                posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+                while((moved = read(in, buf, CP_BUFFER_SIZE)) > 0 && _writeAll(out, (const char*)buf, moved)){
+                    copied += moved;
+                }
+                free(buf);
+            }
+        }
+        if(moved == -1){
+            perror("smash error: cp failed");
+            copied = -1;
+        }
+    }
+    close(in);
+    if(close(out) == -1 && copied != -1){
+        perror("smash error: close failed");
+        copied = -1;
+    }
+    return copied;
+}
+
+//1.5G style, for throughput
+static string _formatRate(double bytes){
+    const char* units[] = {"", "K", "M", "G", "T"};
+    int unit = 0;
+    while(unit < 4 && bytes >= 1024){
+        bytes /= 1024;
+        unit++;
+    }
+    ostringstream str;
+    str << fixed << setprecision(unit == 0 ? 0 : 1) << bytes << units[unit];
+    return str.str();
+}
+
+//cp <src> <dst> or cp <src>... <dir>. several sources are copied concurrently
+void CpCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    if(num_of_args < 3){
+        cerr << "smash error: cp: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    string target(args[num_of_args - 1]);
+    struct stat st;
+    bool to_dir = stat(target.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    if(num_of_args > 3 && !to_dir){
+        cerr << "smash error: cp: target " << target << " is not a directory" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    vector<string> sources, destinations;
+    for(int i = 1; i < num_of_args - 1; i++){
+        string src(args[i]);
+        sources.push_back(src);
+        destinations.push_back(to_dir ? target + "/" + src.substr(src.find_last_of('/') + 1) : target);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vector<long> results;
+    if(sources.size() == 1){ //nothing to overlap, don't pay for a fork
+        results.push_back(_copyFile(sources[0], destinations[0]));
+    }
+    else{
+        results = _runParallel(sources.size(), [&](size_t i){ return (long)_copyFile(sources[i], destinations[i]); });
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long total = 0;
+    size_t files = 0;
+    for(size_t i = 0; i < results.size(); i++){
+        if(results[i] >= 0){
+            total += results[i];
+            files++;
+        }
+        else{ //_copyFile said why
+            smash.last_status = 1;
+        }
+    }
+    if(files == 0){ //every copy failed and said why
+        return;
+    }
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    ostringstream report;
+    report << fixed << setprecision(3) << secs;
+    cout << "cp: " << files << (files == 1 ? " file, " : " files, ") << _formatRate(total) << " in " << report.str()
+         << " secs (" << _formatRate(secs > 0 ? total / secs : 0) << "/s)" << endl;
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************XARGS**************************************
+****************************************************************************
+***************************************************************************/
+
+XargsCommand::XargsCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid), null_separated(false), max_args(-1), parallel(1), first_cmd_arg(1) {
+    is_in_bg = _isBackgroundCommand(cmd_line);
+}
+
+void XargsCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    int i = 1;
+    for(; i < num_of_args && *args[i] == '-'; i++){
+        if(strcmp(args[i], "-0") == 0){
+            null_separated = true;
+        }
+        else if(strcmp(args[i], "-n") == 0 && i + 1 < num_of_args && is_digits(args[i + 1]) && atoi(args[i + 1]) > 0){
+            max_args = atoi(args[++i]);
+        }
+        else if(strcmp(args[i], "-P") == 0 && i + 1 < num_of_args && is_digits(args[i + 1]) && atoi(args[i + 1]) >= 0){
+            parallel = atoi(args[++i]);
+            if(parallel == 0){ //as many as there are cores
+                parallel = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+            }
+        }
+        else if(strcmp(args[i], "--") == 0){
+            i++;
+            break;
+        }
+        else{
+            cerr << "smash error: xargs: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    first_cmd_arg = i;
+    launchForked();
+}
+
+//what an argument or environment string takes from ARG_MAX: its bytes, the nul and its pointer
+static size_t _execCost(const char* str){
+    return strlen(str) + 1 + sizeof(char*);
+}
+
+//GNU xargs statuses: 123 when a run failed, 124 when one exited 255, 125 when one was killed, 126/127 when cmd couldn't run
+static int _xargsStatus(int status){
+    if(WIFSIGNALED(status)){
+        return 125;
+    }
+    int code = WEXITSTATUS(status);
+    if(code == 255){
+        return 124;
+    }
+    if(code == 126 || code == 127){
+        return code;
+    }
+    return code == 0 ? 0 : 123;
+}
+
+/**
+* Tokens are read from stdin chunk by chunk and packed into one nul separated buffer, and a run
+* gets pointers into it, so packing only counts bytes. a run is launched as soon as it is full:
+* when the next token would push the argument and environment strings past ARG_MAX (less 2K of
+* headroom, like POSIX asks) or -n is reached. the buffer never holds more than one run
+*/
+void XargsCommand::childMain(){
+    SmallShell& smash = SmallShell::getInstance();
+    vector<char*> base;
+    for(int i = first_cmd_arg; i < num_of_args; i++){
+        base.push_back(args[i]);
+    }
+    if(base.empty()){
+        base.push_back(const_cast<char*>("echo"));
+    }
+    char** envp = smash.getEnvp();
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t base_cost = sizeof(char*) * 2; //the argv and envp terminators
+    for(char** env = envp; *env; env++){
+        base_cost += _execCost(*env);
+    }
+    for(size_t i = 0; i < base.size(); i++){
+        base_cost += _execCost(base[i]);
+    }
+    size_t budget = arg_max > 4096 ? arg_max - 2048 : arg_max;
+    if(base_cost >= budget){
+        cerr << "smash error: xargs: environment is too large for exec" << endl;
+        exit(1);
+    }
+    string tokens;
+    vector<size_t> starts;
+    size_t used = base_cost;
+    string token; //the one being read, it can span chunks
+    bool in_token = false;
+    int status = 0, running = 0;
+    bool aborted = false;
+    //reaps the runs that ended, waiting for the first one when block is set. like GNU xargs,
+    //nothing more is launched once a run exited 255
+    auto reap = [&](bool block){
+        int child_status;
+        while(running > 0 && waitpid(-1, &child_status, block ? 0 : WNOHANG) > 0){
+            running--;
+            block = false;
+            int code = _xargsStatus(child_status);
+            status = max(status, code);
+            if(code == 124 && !aborted){
+                cerr << "smash error: xargs: " << base[0] << " exited with status 255, aborting" << endl;
+                aborted = true;
+            }
+        }
+    };
+    //returns false once nothing more should be launched
+    auto launch = [&](){
+        if(starts.empty()){
+            return !aborted;
+        }
+        reap(running == parallel); //a slot frees up when any run ends
+        if(aborted){
+            return false;
+        }
+        vector<char*> argv(base.begin(), base.end());
+        for(size_t i = 0; i < starts.size(); i++){
+            argv.push_back(&tokens[starts[i]]);
+        }
+        argv.push_back(nullptr);
+        cout.flush();
+        pid_t child = fork();
+        if(child == -1){
+            perror("smash error: fork failed");
+            status = max(status, 1);
+            return false;
+        }
+        if(child == 0){
+            execvpe(argv[0], argv.data(), envp);
+            perror("smash error: execvp failed");
+            _exit(errno == ENOENT ? 127 : 126);
+        }
+        running++;
+        tokens.clear();
+        starts.clear();
+        used = base_cost;
+        return true;
+    };
+    //a finished token joins the run, which is launched first if the token doesn't fit in it
+    auto add = [&](){
+        size_t cost = _execCost(token.c_str());
+        if(base_cost + cost > budget || token.length() + 1 > 32 * 4096){ //MAX_ARG_STRLEN caps a single string
+            cerr << "smash error: xargs: argument line too long" << endl;
+            status = max(status, 1);
+            return false;
+        }
+        if(used + cost > budget && !launch()){
+            return false;
+        }
+        starts.push_back(tokens.size());
+        tokens.append(token);
+        tokens += '\0';
+        used += cost;
+        token.clear();
+        in_token = false;
+        return max_args == -1 || (int)starts.size() < max_args || launch();
+    };
+    bool more = true;
+    bool read_ok = _readChunks(STDIN, [&](const char* data, size_t size){
+        for(size_t pos = 0; pos < size && more; pos++){
+            size_t len = 0;
+            while(pos + len < size && (null_separated ? data[pos + len] != '\0' : !isspace((unsigned char)data[pos + len]))){
+                len++;
+            }
+            token.append(data + pos, len);
+            in_token = in_token || len > 0;
+            pos += len;
+            if(pos < size && (in_token || null_separated)){ //-0 keeps empty tokens, whitespace runs are one separator
+                more = add();
+            }
+        }
+        reap(false);
+        return more && !aborted;
+    });
+    if(!read_ok){
+        status = max(status, 1);
+    }
+    else if(more && !aborted && (!in_token || add())){
+        launch();
+    }
+    while(running > 0){
+        reap(true);
+    }
+    exit(status);
+}
+
+/***************************************************************************
+****************************************************************************
+*****************************VARIABLES**************************************
+****************************************************************************
+***************************************************************************/
+
+ExportCommand::ExportCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid){}
+
+void ExportCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    if(num_of_args == 1){ //no arguments, print the environment children get
+        map<string, string> env = smash.getExportedVariables();
+        for(map<string, string>::iterator iter = env.begin(); iter != env.end(); iter++){
+            cout << "export " << iter->first << "=" << iter->second << endl;
+        }
+        return;
+    }
+    for(int i = 1; i < num_of_args; i++){
+        string arg(args[i]);
+        size_t eq = arg.find('=');
+        string name = arg.substr(0, eq);
+        if(!_isValidVarName(name)){
+            cerr << "smash error: export: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        if(eq != string::npos){
+            smash.setVariable(name, arg.substr(eq + 1));
+        }
+        smash.exportVariable(name);
+    }
+}
+
+UnsetCommand::UnsetCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid){}
+
+void UnsetCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    for(int i = 1; i < num_of_args; i++){
+        if(!_isValidVarName(args[i])){
+            cerr << "smash error: unset: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        smash.unsetVariable(args[i]);
+    }
+}
+
+AssignmentCommand::AssignmentCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid){}
+
+void AssignmentCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    string arg(args[0]);
+    size_t eq = arg.find('=');
+    smash.setVariable(arg.substr(0, eq), arg.substr(eq + 1));
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************SCHED**************************************
+****************************************************************************
+***************************************************************************/
+
+SchedCommand::SchedCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs){}
+
+void SchedCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    int i = 1;
+    JobsList::JobEntry* job = nullptr;
+    if(num_of_args > 1 && *args[1] != '-' && is_digits(args[1])){ //sched <job-id> ..., resolved like setcore does
+        job = jobs->getJobById(atoi(args[1]));
+        if(job == nullptr){
+            cerr << "smash error: sched: job-id " << args[1] << " does not exist" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        i++;
+    }
+    JobSched requested;
+    for(; i < num_of_args && strncmp(args[i], "--", 2) == 0; i += 2){
+        if(i + 1 >= num_of_args){
+            cerr << "smash error: sched: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        string value(args[i + 1]);
+        bool valid = true;
+        if(strcmp(args[i], "--nice") == 0){
+            valid = is_digits(value) && value.find('-', 1) == string::npos && value != "-";
+            requested.has_nice = valid;
+            requested.nice = atoi(value.c_str());
+        }
+        else if(strcmp(args[i], "--policy") == 0){
+            requested.policy = value == "batch" ? SCHED_BATCH : value == "idle" ? SCHED_IDLE : value == "other" ? SCHED_OTHER : -1;
+            valid = requested.policy != -1;
+        }
+        else if(strcmp(args[i], "--io") == 0){
+            if(value == "idle"){
+                requested.io_class = 3;
+            }
+            else if((value.compare(0, 3, "be:") == 0 || value.compare(0, 3, "rt:") == 0) && value.length() == 4 && isdigit(value[3])){
+                requested.io_class = value[0] == 'r' ? 1 : 2;
+                requested.io_level = value[3] - '0';
+            }
+            else{
+                valid = false;
+            }
+        }
+        else{
+            valid = false;
+        }
+        if(!valid){
+            cerr << "smash error: sched: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    if(!requested.any() || (job != nullptr && i != num_of_args) || (job == nullptr && i == num_of_args)){
+        cerr << "smash error: sched: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    if(job == nullptr){ //sched ... <cmd>: the child applies them to itself before exec
+        smash.pending_sched = &requested;
+        string inner = _skipWords(cmd_line, i);
+        smash.executeCommand(inner.c_str());
+        smash.pending_sched = nullptr;
+        return;
+    }
+    if(job->state != PENDING){ //a pending job gets them when it starts
+        _applySched(job->process_id, requested);
+    }
+    JobSched& sched = job->cmd->sched;
+    if(requested.has_nice){
+        sched.has_nice = true;
+        sched.nice = requested.nice;
+    }
+    if(requested.policy != -1){
+        sched.policy = requested.policy;
+    }
+    if(requested.io_class != -1){
+        sched.io_class = requested.io_class;
+        sched.io_level = requested.io_level;
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*********************************LIMIT**************************************
+****************************************************************************
+***************************************************************************/
+
+LimitCommand::LimitCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs){}
+
+void LimitCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    int i = 1;
+    JobsList::JobEntry* job = nullptr;
+    if(num_of_args > 1 && *args[1] != '-' && is_digits(args[1])){ //limit <job-id> ...
+        job = jobs->getJobById(atoi(args[1]));
+        if(job == nullptr){
+            cerr << "smash error: limit: job-id " << args[1] << " does not exist" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        i++;
+    }
+    JobLimits requested;
+    for(; i < num_of_args && strncmp(args[i], "--", 2) == 0; i += 2){
+        if(i + 1 >= num_of_args){
+            cerr << "smash error: limit: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        if(strcmp(args[i], "--mem") == 0){
+            requested.mem_bytes = _parseSize(args[i + 1]);
+        }
+        else if(strcmp(args[i], "--cpu") == 0){
+            char* end;
+            requested.cpu_percent = strtol(args[i + 1], &end, 10);
+            if(end == args[i + 1] || (*end != '\0' && strcmp(end, "%") != 0) || requested.cpu_percent <= 0){
+                requested.cpu_percent = -2;
+            }
+        }
+        else if(strcmp(args[i], "--nofile") == 0){
+            requested.nofile = is_digits(args[i + 1]) && *args[i + 1] != '-' ? atol(args[i + 1]) : -2;
+        }
+        else{
+            cerr << "smash error: limit: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        if(requested.mem_bytes < -1 || (requested.mem_bytes == -1 && strcmp(args[i], "--mem") == 0) ||
+           requested.cpu_percent < -1 || requested.nofile < -1){
+            cerr << "smash error: limit: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+    }
+    if(!requested.any() || (job != nullptr && i != num_of_args) || (job == nullptr && i == num_of_args)){
+        cerr << "smash error: limit: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    if(job == nullptr){ //limit ... <cmd>: the launcher applies the limits in the child before exec
+        smash.pending_limits = &requested;
+        string inner = _skipWords(cmd_line, i);
+        smash.executeCommand(inner.c_str());
+        smash.pending_limits = nullptr;
+        return;
+    }
+    //an existing job: raise or lower the caps in place
+    JobLimits& limits = job->cmd->limits;
+    if(requested.mem_bytes != -1) limits.mem_bytes = requested.mem_bytes;
+    if(requested.cpu_percent != -1) limits.cpu_percent = requested.cpu_percent;
+    if(requested.nofile != -1) limits.nofile = requested.nofile;
+    bool had_cgroup = !limits.cgroup.empty();
+    if(!_setupCgroup(limits) && limits.cpu_percent != -1){
+        cerr << "smash error: limit: no writable cgroup v2 with the cpu controller, --cpu ignored" << endl;
+        limits.cpu_percent = -1;
+    }
+    if(job->state == PENDING){ //its child joins the cgroup and sets the rlimits when it starts
+        return;
+    }
+    if(!had_cgroup && !limits.cgroup.empty()){
+        vector<pid_t> members = _processGroupMembers(job->process_id);
+        for(size_t j = 0; j < members.size(); j++){
+            _writeFile(limits.cgroup + "/cgroup.procs", std::to_string(members[j]));
+        }
+    }
+    _applyRlimits(job->process_id, limits);
+}
+
+/***************************************************************************
+****************************************************************************
+********************************CAPTURE*************************************
+****************************************************************************
+***************************************************************************/
+
+#define DEFAULT_CAPTURE_SIZE (1 << 20)
+
+CaptureCommand::CaptureCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid){}
+
+void CaptureCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    JobOutput requested;
+    requested.capacity = DEFAULT_CAPTURE_SIZE;
+    int i = 1;
+    if(num_of_args > 2 && strcmp(args[1], "-s") == 0){
+        long long size = _parseSize(args[2]);
+        if(size <= 0){
+            cerr << "smash error: capture: invalid arguments" << endl;
+            smash.last_status = 1;
+            return;
+        }
+        requested.capacity = size;
+        i = 3;
+    }
+    string inner = _skipWords(cmd_line, i);
+    if(inner.empty()){
+        cerr << "smash error: capture: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    if(!_isBackgroundCommand(inner.c_str())){ //a foreground command's output is on the terminal anyway
+        cerr << "smash error: capture: only background commands can be captured" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    smash.pending_output = &requested;
+    smash.executeCommand(inner.c_str());
+    if(smash.pending_output != nullptr){ //nothing forked a job to hand it to (pipes, redirections)
+        cerr << "smash error: capture: this command can't be captured" << endl;
+        smash.last_status = 1;
+        smash.pending_output = nullptr;
+    }
+}
+
+OutputCommand::OutputCommand(const char* cmd_line, JobsList* jobs, int pid): BuiltInCommand(cmd_line, pid), jobs(jobs), follow_from(0){}
+
+void OutputCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    bool follow = num_of_args == 3 && strcmp(args[2], "-f") == 0;
+    if((num_of_args != 2 && !follow) || !is_digits(args[1])){
+        cerr << "smash error: output: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    int job_id = atoi(args[1]);
+    JobsList::JobEntry* job = jobs->getJobById(job_id);
+    map<int, std::unique_ptr<Command>>::iterator done = jobs->finished_captured.find(job_id);
+    if(job == nullptr && done == jobs->finished_captured.end()){
+        cerr << "smash error: output: job-id " << args[1] << " does not exist" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    const JobOutput& output = job != nullptr ? job->cmd->output : done->second->output;
+    if(output.ring == nullptr){
+        cerr << "smash error: output: job-id " << args[1] << " is not captured" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    unsigned long long written = reinterpret_cast<const RingHeader*>(output.ring)->written.load(std::memory_order_acquire);
+    string text;
+    unsigned long long from = _readRing(output, 0, written, text);
+    if(from > 0){ //the oldest line was cut by the wrap around, start at the first whole one
+        size_t nl = text.find('\n');
+        text.erase(0, nl == string::npos ? text.size() : nl + 1);
+    }
+    cout << text << flush;
+    if(job == nullptr){ //the job ended, this was all of it and it has been shown now
+        jobs->finished_captured.erase(done);
+        return;
+    }
+    if(!follow){
+        return;
+    }
+    //-f keeps printing until the job's output ends, in a child so ctrl-C stops it like tail -f
+    followed = output;
+    follow_from = written;
+    launchForked();
+    followed = JobOutput(); //the job still owns the ring
+}
+
+void OutputCommand::childMain(){
+    RingHeader* header = reinterpret_cast<RingHeader*>(followed.ring);
+    unsigned long long printed = follow_from;
+    string text;
+    while(true){
+        int seq = header->seq.load(std::memory_order_acquire);
+        unsigned long long written = header->written.load(std::memory_order_acquire);
+        if(written > printed){
+            _readRing(followed, printed, written, text);
+            _writeAll(STDOUT, text.data(), text.size());
+            printed = written;
+            continue;
+        }
+        if(header->done.load(std::memory_order_acquire)){
+            return;
+        }
+        struct timespec timeout = {1, 0}; //only a safety net, the reader wakes us on every update
+        _futex(&header->seq, FUTEX_WAIT, seq, &timeout);
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+**********************************FARE**************************************
+****************************************************************************
+***************************************************************************/
+///optional.
+
+#define FARE_BLOCK_SIZE (1 << 16)
+
+FareCommand::FareCommand(const char* cmd_line, int pid): BuiltInCommand(cmd_line, pid){}
+
+/**
+* Streams path through a fixed size window into a temp file next to it and renames it over the
+* original, so memory use doesn't depend on the file size and readers never see a half written file.
+* returns the number of replacements or -1 on error
+*/
+long FareCommand::replaceInFile(const std::string& path){
+    int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in == -1){
+        perror("smash error: open failed");
+        return -1;
+    }
+    struct stat st;
+    if(fstat(in, &st) == -1){
+        perror("smash error: fstat failed");
+        close(in);
+        return -1;
+    }
+    //the temp file has to be on the same file system for rename() to be atomic
+    size_t slash = path.find_last_of('/');
+    string dir = slash == string::npos ? "" : path.substr(0, slash + 1);
+    string base = slash == string::npos ? path : path.substr(slash + 1);
+    string temp_path = dir + "." + base + ".fareXXXXXX";
+    int out = mkstemp(&temp_path[0]);
+    if(out == -1){
+        perror("smash error: mkstemp failed");
+        close(in);
+        return -1;
+    }
+    fchmod(out, st.st_mode & 07777);
+    //window holds one block plus the bytes kept back because a match may straddle two blocks
+    vector<char> window(FARE_BLOCK_SIZE + source.length());
+    size_t kept = 0;
+    long replaced = 0;
+    bool failed = false;
+    string pending; //output gathered until it is worth a write()
+    pending.reserve(2 * FARE_BLOCK_SIZE);
+    while(!failed){
+        ssize_t bytes = read(in, window.data() + kept, FARE_BLOCK_SIZE);
+        if(bytes == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            perror("smash error: read failed");
+            failed = true;
+            break;
+        }
+        bool eof = bytes == 0;
+        size_t filled = kept + bytes;
+        //matches can only start before this point, the rest waits for the next block unless it's EOF
+        size_t limit = eof ? filled : (filled >= source.length() ? filled - source.length() + 1 : 0);
+        const char* data = window.data();
+        size_t pos = 0;
+        while(pos < limit){
+            const char* hit = (const char*)memchr(data + pos, source[0], limit - pos);
+            if(hit == nullptr){
+                break;
+            }
+            size_t at = hit - data;
+            if(at + source.length() <= filled && memcmp(hit, source.data(), source.length()) == 0){
+                pending.append(data + pos, at - pos);
+                pending.append(destination);
+                replaced++;
+                pos = at + source.length();
+            }
+            else{
+                pending.append(data + pos, at - pos + 1);
+                pos = at + 1;
+            }
+        }
+        if(pos < limit){
+            pending.append(data + pos, limit - pos);
+            pos = limit;
+        }
+        if(eof){
+            pending.append(data + pos, filled - pos);
+        }
+        if(pending.size() >= FARE_BLOCK_SIZE || eof){
+            if(!_writeAll(out, pending.data(), pending.size())){
+                perror("smash error: write failed");
+                failed = true;
+            }
+            pending.clear();
+        }
+        if(eof){
+            break;
+        }
+        kept = filled - pos;
+        memmove(window.data(), data + pos, kept);
+    }
+    close(in);
+    if(!failed && replaced > 0 && fsync(out) == -1){
+        perror("smash error: fsync failed");
+        failed = true;
+    }
+    close(out);
+    if(failed || replaced == 0){ //nothing to change, leave the original (and its mtime) alone
+        unlink(temp_path.c_str());
+        return failed ? -1 : 0;
+    }
+    if(rename(temp_path.c_str(), path.c_str()) == -1){
+        perror("smash error: rename failed");
+        unlink(temp_path.c_str());
+        return -1;
+    }
+    return replaced;
+}
+
+void FareCommand::execute(){
+    SmallShell& smash = SmallShell::getInstance();
+    _removeBackgroundArg(args, num_of_args);
+    if(num_of_args < 4 || *args[num_of_args - 2] == '\0'){
+        cerr << "smash error: fare: invalid arguments" << endl;
+        smash.last_status = 1;
+        return;
+    }
+    for(int i = 1; i < num_of_args - 2; i++){
+        files.push_back(args[i]);
+    }
+    source = args[num_of_args - 2];
+    destination = args[num_of_args - 1];
+    if(files.size() == 1){
+        long replaced = replaceInFile(files[0]);
+        if(replaced >= 0){
+            cout << "replaced " << replaced << " instances of the string \"" << source << "\"" << endl;
+        }
+        else{
+            smash.last_status = 1;
+        }
+        return;
+    }
+    //every file is independent, so they are processed by parallel workers
+    vector<long> results = _runParallel(files.size(), [this](size_t i) { return replaceInFile(files[i]); });
+    for(size_t i = 0; i < files.size(); i++){
+        if(results[i] >= 0){
+            cout << files[i] << ": replaced " << results[i] << " instances of the string \"" << source << "\"" << endl;
+        }
+        else{
+            smash.last_status = 1;
+        }
+    }
+}
+
+/***************************************************************************
+****************************************************************************
+*************************EXTERNAL_COMMANDS**********************************
+****************************************************************************
+***************************************************************************/
+
+ExternalCommand::ExternalCommand(const char* cmd_line, int pid) : Command(cmd_line, false, pid) {
+    is_in_bg = _isBackgroundCommand(cmd_line); //this field is from the general Command
+}
+
+void ExternalCommand::execute() { //need to check if simple or complex...
+    SmallShell& smash = SmallShell::getInstance();
+    if(num_of_args > 1 && strcmp(args[num_of_args-1], "&") == 0){ //a separate & is not an argument of the program
+        free(args[--num_of_args]);
+        args[num_of_args] = nullptr;
+    }
+    //cmd_line stays as typed, it is what jobs prints. bash gets the line without the &
+    string line = _trim(string(cmd_line));
+    if(!line.empty() && line[line.length()-1] == '&'){
+        line = _rtrim(line.substr(0, line.length()-1));
+    }
+    char** envp = smash.getEnvp(); //rebuilt here in the parent at most once, children only get the pointer
+    _takePendingAttrs(this);
+    pid_t child = fork();
+    if(child != 0) {
+        _closeOutputWriter(output); //only the job writes into the capture pipe
+    }
+    if(child == -1) {
+        perror("smash error: fork failed");
+        return;
+    }
+    if(child == 0) {  /// child
+        setpgrp();
+        prepareChild();
+        if(is_complex_command(cmd_line)) { //complex command
+            string expanded = smash.expandVariables(line);
+            execle("/bin/bash", "/bin/bash", "-c", expanded.c_str(), nullptr, envp);
+            perror("smash error: execl failed");
+        }
+        else { //simple command
+            _removeGivenSign(args[num_of_args - 1], '&');
+            execvpe(args[0], &args[0], envp);
+            perror("smash error: execvp failed");
+        }
+        exit(1); //never fall back into the child's copy of the prompt loop
+    }
+    ///parent
+    pid = child;
+    if (is_in_bg) {
+        job_state = BACKGROUND;
+        return;
+    }
+    smash.fg_cmd = this;
+    int status = 0;
+    if (waitpid(child, &status, WUNTRACED) == -1) {
+        perror("smash error: waitpid failed");
+    }
+    smash.fg_cmd = nullptr;
+    smash.last_status = _exitStatus(status);
+    if (WIFSTOPPED(status)) { //ctrl-Z, executeCommand moves it to the jobs list
+        job_state = STOPPED;
     }
-    delete smash.fg_cmd;
-    smash.fg_cmd = nullptr;
-    return;
 }
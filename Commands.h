@@ -4,10 +4,53 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
+#include <set>
+#include <functional>
+#include <memory>
+#include <signal.h>
 
 #define COMMAND_ARGS_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 
+typedef enum
+{
+    FOREGROUND,
+    BACKGROUND,
+    STOPPED,
+    PENDING //registered by after, not started yet
+} Job_State;
+
+//resource caps of a job, -1 means not limited
+struct JobLimits {
+    long long mem_bytes;
+    int cpu_percent;
+    long nofile;
+    std::string cgroup; //cgroup v2 directory the job was put in, empty if none
+    JobLimits() : mem_bytes(-1), cpu_percent(-1), nofile(-1) {}
+    bool any() const { return mem_bytes != -1 || cpu_percent != -1 || nofile != -1; }
+};
+
+//scheduling attributes of a job, unset fields are left as inherited
+struct JobSched {
+    bool has_nice;
+    int nice;
+    int policy; //SCHED_OTHER/BATCH/IDLE, -1 if unset
+    int io_class; //1 rt, 2 best effort, 3 idle, -1 if unset
+    int io_level;
+    JobSched() : has_nice(false), nice(0), policy(-1), io_class(-1), io_level(0) {}
+    bool any() const { return has_nice || policy != -1 || io_class != -1; }
+};
+
+//stdout/stderr of a captured job, kept in a memfd ring (see the CAPTURE section). memfd -1 if not captured
+struct JobOutput {
+    int memfd;
+    char* ring; //shared mapping: a small header, then capacity bytes of data
+    size_t capacity;
+    int writer; //pipe end the job writes to, only open in smash until the job is forked
+    JobOutput() : memfd(-1), ring(nullptr), capacity(0), writer(-1) {}
+};
+
 class Command {
 protected:
     char* args[COMMAND_MAX_ARGS];
@@ -19,10 +62,20 @@ public:
     const char* orig_cmd_line;
     char* cmd_line;
     bool is_in_bg;
+    //what execute() left behind: FOREGROUND means nothing, otherwise the jobs list takes the command over
+    Job_State job_state;
+    JobLimits limits;
+    JobSched sched;
+    JobOutput output;
     Command(const char* original_cmd_line, bool ignore_ampersand, int pid);
     char* getCmdLine();
     virtual ~Command();
     virtual void execute() = 0;
+    //forks a child that runs childMain() and tracks it like an external command (fg wait or jobs list)
+    void launchForked();
+    //called right after fork, in the child (rlimits, cgroup join, priorities) before anything runs
+    void prepareChild();
+    virtual void childMain() {}
     //virtual void prepare();
     //virtual void cleanup();
     // TODO: Add your extra methods if needed
@@ -53,6 +106,26 @@ public:
     void pipe_exec(int pipe_index, bool dup);
     void pipe_ampersand_exec(int pipe_index, bool dup);
 };
+//fans stdin out to files (and stdout) with tee(2)/splice(2). cmd |> f1 >>f2 is tee -q f1 >>f2
+class TeeCommand : public BuiltInCommand {
+public:
+    TeeCommand(const char* cmd_line, int pid);
+    virtual ~TeeCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+//runs N copies of a filter as one pipeline stage: producer | pmap -j N [-k] filter | sink
+class PmapCommand : public BuiltInCommand {
+    int num_of_workers;
+    bool keep_order;
+    std::string worker_cmd;
+public:
+    PmapCommand(const char* cmd_line, int pid);
+    virtual ~PmapCommand() {}
+    void execute() override;
+};
+
 //
 class RedirectionCommand : public Command {
     std::string fixed_cmd;
@@ -61,6 +134,9 @@ class RedirectionCommand : public Command {
     int out_channel;
     int temp_stdout;
     bool append;
+    bool rotate; //cmd >~ file:size:generations
+    long long rotate_size;
+    int rotate_keep;
 public:
     explicit RedirectionCommand(const char* cmd_line, int pid);
     virtual ~RedirectionCommand() {}
@@ -68,6 +144,25 @@ public:
     void prepare();
     void cleanup();
     void split_cmd();
+    int startRotator();
+};
+
+//cmd < file, cmd << DELIM and cmd <<< word: the file (or the inline text) becomes the command's stdin
+class InputRedirectionCommand : public Command {
+    std::string fixed_cmd;
+    std::string file_path;
+    std::string cmd_str;
+    bool here; //<< or <<<, stdin is here_body instead of file_path
+    std::string here_body;
+    int in_channel;
+    int temp_stdin;
+public:
+    explicit InputRedirectionCommand(const char* cmd_line, int pid);
+    virtual ~InputRedirectionCommand() {}
+    void execute() override;
+    void prepare();
+    void cleanup();
+    void split_cmd();
 };
 
 class ChangeDirCommand : public BuiltInCommand {
@@ -103,15 +198,138 @@ public:
     void execute() override;
 };
 
+class ExportCommand : public BuiltInCommand {
+public:
+    ExportCommand(const char* cmd_line, int pid);
+    virtual ~ExportCommand() {}
+    void execute() override;
+};
+
+class UnsetCommand : public BuiltInCommand {
+public:
+    UnsetCommand(const char* cmd_line, int pid);
+    virtual ~UnsetCommand() {}
+    void execute() override;
+};
+
+class AssignmentCommand : public BuiltInCommand {
+public:
+    AssignmentCommand(const char* cmd_line, int pid);
+    virtual ~AssignmentCommand() {}
+    void execute() override;
+};
+
+class TailCommand : public BuiltInCommand {
+    int num_of_lines;
+    bool follow;
+    bool follow_name; //-F, reopen the path when the file is rotated
+    std::vector<std::string> files;
+public:
+    TailCommand(const char* cmd_line, int pid);
+    virtual ~TailCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+//watch -n secs [--diff] [--until-change] <cmd>: reruns cmd on a timer, prints its output when it changed
+class WatchCommand : public BuiltInCommand {
+    double interval;
+    bool diff;
+    bool until_change;
+    std::string watched_cmd;
+public:
+    WatchCommand(const char* cmd_line, int pid);
+    virtual ~WatchCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+class TouchCommand : public BuiltInCommand {
+public:
+    TouchCommand(const char* cmd_line, int pid);
+    virtual ~TouchCommand() {}
+    void execute() override;
+};
+
+class CatCommand : public BuiltInCommand {
+public:
+    CatCommand(const char* cmd_line, int pid);
+    virtual ~CatCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+class HeadCommand : public BuiltInCommand {
+    int num_of_lines;
+    const char* path; //nullptr reads stdin
+public:
+    HeadCommand(const char* cmd_line, int pid);
+    virtual ~HeadCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+class CpCommand : public BuiltInCommand {
+public:
+    CpCommand(const char* cmd_line, int pid);
+    virtual ~CpCommand() {}
+    void execute() override;
+};
+
+class WcCommand : public BuiltInCommand {
+    bool lines;
+    bool words;
+    bool bytes;
+    std::vector<const char*> paths; //nullptr is stdin
+public:
+    WcCommand(const char* cmd_line, int pid);
+    virtual ~WcCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+//xargs [-0] [-n max] [-P procs] [cmd [args]]: runs cmd with the stdin tokens as extra arguments,
+//as many per exec as ARG_MAX allows
+class XargsCommand : public BuiltInCommand {
+    bool null_separated;
+    int max_args; //-1 means as many as fit
+    int parallel;
+    int first_cmd_arg;
+public:
+    XargsCommand(const char* cmd_line, int pid);
+    virtual ~XargsCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+//a && b || c: runs the steps one after another, each one only if the status so far lets it.
+//with a trailing & the whole list is one background job
+class ListCommand : public BuiltInCommand {
+    std::vector<std::string> steps;
+    std::vector<bool> and_ops; //and_ops[i] joins steps[i] and steps[i + 1], && when true and || when false
+public:
+    ListCommand(const char* cmd_line, const std::vector<std::string>& steps, const std::vector<bool>& and_ops, int pid);
+    virtual ~ListCommand() {}
+    void execute() override;
+    void childMain() override;
+    void runSteps();
+};
+
 class JobsList;
 
 
-typedef enum
-{
-    FOREGROUND,
-    BACKGROUND,
-    STOPPED
-} Job_State;
+//owned pidfd, closed with it. a pidfd keeps naming the same process even after its pid is reused
+class PidFd {
+    int fd;
+public:
+    explicit PidFd(pid_t pid);
+    PidFd(PidFd&& other) : fd(other.fd) { other.fd = -1; }
+    PidFd& operator=(PidFd&& other);
+    PidFd(PidFd const&) = delete;
+    void operator=(PidFd const&) = delete;
+    ~PidFd();
+    int get() const { return fd; }
+};
 
 class JobsList {
 public:
@@ -121,27 +339,76 @@ public:
         int job_id;
         int process_id;
         Job_State state;
-        Command* cmd;
-        JobEntry(int process_id, int job_id, Command* cmd, Job_State state);
+        std::unique_ptr<Command> cmd; //the job owns its command, it is freed when the job is removed
+        PidFd pidfd;
+        std::vector<int> depends_on; //a PENDING job starts once none of these job-ids is listed anymore
+        bool needs_success; //after --ok: only if all of them exited with 0, otherwise it is cancelled
+        bool scheduled; //started by the scheduler, counts against the concurrency cap
+        JobEntry(int process_id, int job_id, std::unique_ptr<Command> cmd, Job_State state);
+        //signals the job's process (or its whole process group) through the pidfd, false with errno set on failure
+        bool signal(int sig, bool group = false);
     };
 public:
     int max;
-    std::vector<JobsList::JobEntry>* jobs_list;
+    std::vector<JobsList::JobEntry>* jobs_list; //sorted by job_id
+    std::vector<std::pair<pid_t, int>> unclaimed; //children (and their status) the last removeFinishedJobs reaped that weren't listed
+    std::map<int, int> exit_statuses; //wait status of finished jobs, kept while pending jobs may need them
+    //captured jobs that ended, kept with their ring until output or jobs has shown them. their ids aren't reused meanwhile
+    std::map<int, std::unique_ptr<Command>> finished_captured;
+    int max_scheduled; //cap on scheduler started jobs running at once, 0 for none
+    bool scheduling;
+    pid_t owner; //the shell process. forked children (pipe stages, forked builtins) only hold a stale copy
+    bool collecting; //set while a wait builtin runs, every job that finishes is appended to collected
+    std::vector<std::pair<int, int>> collected; //job id and wait status
     JobsList();
     ~JobsList();
     std::vector<JobsList::JobEntry>* getJobsList();
     void updateMax();
-    void addJob(Command* cmd, Job_State state, int job_id);
-    void printJobsList();
+    int addJob(std::unique_ptr<Command> cmd, Job_State state, int job_id);
+    void printJobsList(bool verbose = false);
     void killAllJobs();
     void removeFinishedJobs(); //need to go over again
     JobEntry * getJobById(int jobId);
     void removeJobById(int jobId);
     JobEntry * getLastJob();
     JobEntry *getLastStoppedJob();
+    bool hasPending();
+    void recordExit(int job_id, int status);
+    void cancelJob(int job_id);
+    void startReadyJobs();
     // TODO: Add extra methods or modify exisitng ones as needed
 };
 
+//after [-j N] [--ok] <job-id>... -- <cmd>: cmd becomes a pending job that starts when those jobs are done
+class AfterCommand : public BuiltInCommand {
+    JobsList* jobs;
+public:
+    AfterCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~AfterCommand() {}
+    void execute() override;
+};
+
+//jobstat [-i secs] [-n count]: top for the jobs list, cpu, rss, state and i/o rates of each job's process group
+class JobStatCommand : public BuiltInCommand {
+    JobsList* jobs;
+    double interval;
+    int count;
+public:
+    JobStatCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~JobStatCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+//wait [-n] [job-id...]: blocks until the jobs (all of them by default, the first one with -n) are done
+class WaitCommand : public BuiltInCommand {
+    JobsList* jobs;
+public:
+    WaitCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~WaitCommand() {}
+    void execute() override;
+};
+
 class QuitCommand : public BuiltInCommand {
     JobsList* jobs;
 public:
@@ -185,11 +452,14 @@ public:
 
 class FareCommand : public BuiltInCommand {
     /* Optional */
-    // TODO: Add your data members
+    std::vector<std::string> files;
+    std::string source;
+    std::string destination;
 public:
     FareCommand(const char* cmd_line, int pid); //need to split to 3 parameters
     virtual ~FareCommand() {}
     void execute() override;
+    long replaceInFile(const std::string& path);
 };
 
 class SetcoreCommand : public BuiltInCommand {
@@ -201,10 +471,46 @@ public:
     void execute() override;
 };
 
+//capture [-s size] <cmd> &: the job's stdout/stderr go into a ring buffer instead of the terminal
+class CaptureCommand : public BuiltInCommand {
+public:
+    CaptureCommand(const char* cmd_line, int pid);
+    virtual ~CaptureCommand() {}
+    void execute() override;
+};
+
+//output <job-id> [-f]: prints (or follows) what a captured job wrote
+class OutputCommand : public BuiltInCommand {
+    JobsList* jobs;
+    JobOutput followed; //the job's ring, for the -f child
+    unsigned long long follow_from;
+public:
+    OutputCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~OutputCommand() {}
+    void execute() override;
+    void childMain() override;
+};
+
+class SchedCommand : public BuiltInCommand {
+    JobsList* jobs;
+public:
+    SchedCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~SchedCommand() {}
+    void execute() override;
+};
+
+class LimitCommand : public BuiltInCommand {
+    JobsList* jobs;
+public:
+    LimitCommand(const char* cmd_line, JobsList* jobs, int pid);
+    virtual ~LimitCommand() {}
+    void execute() override;
+};
+
 class KillCommand : public BuiltInCommand {
     /* Bonus */
-    // TODO: Add your data members
     JobsList* jobs;
+    bool selectJobs(std::vector<JobsList::JobEntry*>& selected);
 public:
     KillCommand(const char* cmd_line, JobsList* jobs, int pid);
     virtual ~KillCommand() {}
@@ -215,11 +521,25 @@ class SmallShell {
 private:
     std::string prompt;
     char* prev_path;
+    std::map<std::string, std::string> variables;
+    std::set<std::string> exported;
+    //prebuilt envp handed to every exec. shared by all spawns until a variable
+    //write marks it dirty, then rebuilt once on the next spawn
+    std::vector<std::string> envp_strings;
+    std::vector<char*> envp_block;
+    bool envp_dirty;
+    int record_fd; //-1 unless smash runs with --record
+    int exec_depth; //executeCommand calls in progress, only the outermost one is recorded
     SmallShell();
 public:
-    Command* fg_cmd;
+    Command* fg_cmd; //not owned, the command being waited for
     int fg_cmd_job_id;
+    JobLimits* pending_limits; //set by limit for the command it launches
+    JobSched* pending_sched; //set by sched for the command it launches
+    JobOutput* pending_output; //set by capture for the command it launches
     JobsList* Jobs_List;
+    volatile sig_atomic_t interrupted; //set by the ctrl-C handler, for builtins that block in smash itself
+    int last_status; //exit status of the last foreground command, 128 + the signal if one killed or stopped it
     char** getPlastPwd();
     void setPlastPwd(char** new_plast);
     bool is_prompt_changed;
@@ -236,6 +556,17 @@ public:
     }
     ~SmallShell();
     void executeCommand(const char* cmd_line);
+    void runCommand(const char* cmd_line, Command* cmd = nullptr);
+    void waitForInput();
+    bool startRecording(const char* path);
+    void replaySession(const char* path, bool timed);
+    bool getVariable(const std::string& name, std::string& value);
+    void setVariable(const std::string& name, const std::string& value);
+    void exportVariable(const std::string& name);
+    void unsetVariable(const std::string& name);
+    std::map<std::string, std::string> getExportedVariables();
+    std::string expandVariables(const std::string& word);
+    char** getEnvp();
     // TODO: add extra methods as needed
 };
 
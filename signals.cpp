@@ -1,5 +1,7 @@
 #include <iostream>
 #include <signal.h>
+#include <unistd.h>
+#include <errno.h>
 #include "signals.h"
 #include "Commands.h"
 
@@ -9,11 +11,10 @@ void ctrlZHandler(int sig_num) {
     cout << "smash: got ctrl-Z" << endl;
     SmallShell& smash = SmallShell::getInstance();
     //Command* current_fg_cmd = smash.fg_cmd;
-    if (smash.fg_cmd) //there is a command in the fg of smash. need to add to jobs list and send SIGSTP
+    if (smash.fg_cmd) //there is a command in the fg of smash. need to send SIGSTP
     {
-        smash.Jobs_List->addJob(smash.fg_cmd, STOPPED, smash.fg_cmd_job_id);
-
-        //second, send SIGSTOP
+        //the waiter sees it stopped and moves the command to the jobs list, that's not safe to do in a handler
+        //send SIGSTOP
         if (kill(smash.fg_cmd->pid, SIGSTOP) == -1) 
         {
             perror("smash error: kill failed");
@@ -21,13 +22,13 @@ void ctrlZHandler(int sig_num) {
         }
         cout << "smash: process " << smash.fg_cmd->pid << " was stopped" << endl;
     }
-    smash.fg_cmd = nullptr;
     return;
 }
 
 void ctrlCHandler(int sig_num) {
     cout << "smash: got ctrl-C" << endl;
     SmallShell& smash = SmallShell::getInstance();
+    smash.interrupted = 1;
     //Command* current_fg_cmd = smash.fg_cmd;
     if (smash.fg_cmd) //there is a command in the fg of smash. need to send SIGKILL
     {
@@ -44,3 +45,32 @@ void ctrlCHandler(int sig_num) {
 void alarmHandler(int sig_num) {
     // TODO: Add your implementation
 }
+
+int session_socket = -1;
+
+void sigioHandler(int) {
+    int saved_errno = errno; //whatever this interrupted may still look at errno
+    char keys[16];
+    ssize_t len;
+    while((len = read(session_socket, keys, sizeof(keys))) > 0) {
+        for(ssize_t i = 0; i < len; i++) {
+            if(keys[i] == 'C') {
+                ctrlCHandler(SIGINT);
+            }
+            else if(keys[i] == 'Z') {
+                ctrlZHandler(SIGTSTP);
+            }
+        }
+    }
+    if(len == 0) { //the client is gone, like a terminal hanging up
+        kill(getpid(), SIGHUP);
+    }
+    errno = saved_errno;
+}
+
+void forwardHandler(int sig_num) {
+    int saved_errno = errno;
+    char key = sig_num == SIGINT ? 'C' : 'Z';
+    write(session_socket, &key, 1); //a session that is gone shows up as EOF on the client's next read
+    errno = saved_errno;
+}
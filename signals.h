@@ -11,4 +11,9 @@ void ctrlZHandler(int sig_num); //route SIGSTP to fg cmd
 void ctrlCHandler(int sig_num); //route SIGINT to fg cmd
 void alarmHandler(int sig_num);
 
+//the connection between a --connect client and its --serve session, ctrl-C/ctrl-Z travel on it as 'C'/'Z'
+extern int session_socket;
+void sigioHandler(int sig_num); //session side: a forwarded key arrived, or the client hung up
+void forwardHandler(int sig_num); //client side: sends the key to the session instead of acting on it
+
 #endif //SMASH__SIGNALS_H_
\ No newline at end of file
@@ -1,10 +1,206 @@
 #include <iostream>
 #include <unistd.h>
+#include <string.h>
 //#include <sys/wait.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "Commands.h"
 #include "signals.h"
 
+//the prompt loop, until quit or the end of the input
+static void runPrompt(SmallShell& smash) {
+    while(true) {
+        std::cout << smash.getPrompt() + "> ";
+        if(isatty(STDIN_FILENO)) { //a tty hands over one line per read, so nothing can sit unread in cin's buffer
+            std::cout.flush();
+            smash.waitForInput();
+        }
+        std::string cmd_line;
+        if(!std::getline(std::cin, cmd_line)) { //ctrl-D or the end of a script, jobs are left running like quit does
+            if(isatty(STDIN_FILENO)) {
+                std::cout << std::endl;
+            }
+            return;
+        }
+        smash.executeCommand(cmd_line.c_str());
+    }
+}
+
+static bool socketAddress(const char* path, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        std::cerr << "smash error: socket path is too long" << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+//a client sends its stdin, stdout, stderr and cwd. they become the session's own 0, 1, 2 and cwd
+static bool receiveClient(int conn) {
+    int fds[4];
+    char byte;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return false;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    for(int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    bool moved = fchdir(fds[3]) == 0;
+    close(fds[3]);
+    return moved;
+}
+
+static pid_t session_pid = -1;
+
+//anything the session forked may still hold the connection, shutting it down ends the client anyway
+static void endSession() {
+    if(getpid() == session_pid) {
+        shutdown(session_socket, SHUT_RDWR);
+    }
+}
+
+//only a socket nobody listens on is stale, a live server's is left alone
+static bool staleSocket(const struct sockaddr_un& addr) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(probe == -1) {
+        return false;
+    }
+    bool refused = connect(probe, (const struct sockaddr*)&addr, sizeof(addr)) == -1 && errno == ECONNREFUSED;
+    close(probe);
+    return refused;
+}
+
+/**
+* smash --serve path: one smash that was started once, forking a session per client. a session is
+* a copy of the idle shell (fresh prompt, jobs list, cwd) so a client gets a shell with no exec or
+* startup cost. the sessions run detached from the server's terminal, the connection itself
+* carries the client's ctrl-C/ctrl-Z, delivered with SIGIO, and its hangup
+*/
+static int serve(SmallShell& smash, const char* path) {
+    struct sockaddr_un addr;
+    if(!socketAddress(path, addr)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listener == -1) {
+        perror("smash error: socket failed");
+        return 1;
+    }
+    struct stat st;
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && staleSocket(addr)) { //left over by a server that was killed
+        unlink(path);
+    }
+    mode_t old_mask = umask(0077); //whoever can connect runs commands as us
+    int bound = bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if(bound == -1 || listen(listener, SOMAXCONN) == -1) {
+        perror("smash error: bind failed");
+        return 1;
+    }
+    signal(SIGCHLD, SIG_IGN); //sessions are never waited for
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    std::cout.flush();
+    while(true) {
+        int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if(conn == -1) {
+            if(errno != EINTR) {
+                perror("smash error: accept failed");
+            }
+            continue;
+        }
+        pid_t session = fork();
+        if(session == -1) {
+            perror("smash error: fork failed");
+        }
+        if(session != 0) {
+            close(conn);
+            continue;
+        }
+        close(listener);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGTSTP, ctrlZHandler);
+        signal(SIGINT, ctrlCHandler);
+        setsid();
+        smash.Jobs_List->owner = getpid(); //the session is the shell its jobs belong to
+        if(!receiveClient(conn)) {
+            exit(1);
+        }
+        session_socket = conn;
+        session_pid = getpid();
+        atexit(endSession);
+        signal(SIGIO, sigioHandler);
+        fcntl(conn, F_SETOWN, getpid());
+        fcntl(conn, F_SETFL, O_ASYNC | O_NONBLOCK);
+        runPrompt(smash);
+        exit(0);
+    }
+}
+
+//smash --connect path: hands this terminal to a session of the server and waits for it to end
+static int connectTo(const char* path) {
+    struct sockaddr_un addr;
+    if(!socketAddress(path, addr)) {
+        return 1;
+    }
+    session_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(session_socket == -1 || connect(session_socket, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("smash error: connect failed");
+        return 1;
+    }
+    int fds[4] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, open(".", O_PATH | O_CLOEXEC)};
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if(fds[3] == -1 || sendmsg(session_socket, &msg, 0) != 1) {
+        perror("smash error: sendmsg failed");
+        return 1;
+    }
+    close(fds[3]);
+    signal(SIGINT, forwardHandler);
+    signal(SIGTSTP, forwardHandler);
+    char buf[64];
+    ssize_t len;
+    while((len = read(session_socket, buf, sizeof(buf))) != 0) { //the session only ever closes it
+        if(len == -1 && errno != EINTR) {
+            perror("smash error: read failed");
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
    if(signal(SIGTSTP , ctrlZHandler)==SIG_ERR) {
        perror("smash error: failed to set ctrl-Z handler");
@@ -15,12 +211,43 @@ int main(int argc, char* argv[]) {
 
     //TODO: setup sig alarm handler
 
+    //smash [--record file] [--replay file [--timed]] [--serve sock | --connect sock]
+    const char* replay_path = nullptr;
+    const char* serve_path = nullptr;
+    bool timed = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--connect") == 0 && i + 1 < argc) { //before the shell is even set up, the client stays tiny
+            return connectTo(argv[i + 1]);
+        }
+    }
     SmallShell& smash = SmallShell::getInstance();
-    while(true) {
-        std::cout << smash.getPrompt() + "> ";
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        smash.executeCommand(cmd_line.c_str());
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            if(!smash.startRecording(argv[++i])) {
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--timed") == 0) {
+            timed = true;
+        }
+        else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        }
+        else {
+            std::cerr << "smash error: invalid arguments" << std::endl;
+            return 1;
+        }
+    }
+    if(replay_path != nullptr) {
+        smash.replaySession(replay_path, timed);
+        return 0;
+    }
+    if(serve_path != nullptr) {
+        return serve(smash, serve_path);
     }
+    runPrompt(smash);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""
+Load test for smash job control.
+
+Starts smash on a pty, fills its jobs list with N `sleep` jobs and measures, at each size,
+how long the shell takes to answer:
+  prompt      an empty line, back to the prompt (removeFinishedJobs runs on every command)
+  jobs        the whole `jobs` listing
+  kill        `kill -18 <id>` (SIGCONT, the job keeps running)
+  fg          `fg <id>` until the job's line is printed
+  ctrl_z      ctrl-Z on that foreground job, until the prompt is back
+  bg          `bg <id>` on the stopped job
+  ctrl_c      ctrl-C on a foreground job, until the prompt is back
+plus `launch`, the seconds it took to start all N jobs.
+
+    g++ -std=c++11 -O2 -o smash *.cpp
+    tools/jobs_load.py ./smash                       # 1000, 10000 and 50000 jobs, JSON on stdout
+    tools/jobs_load.py ./smash --counts 1000 --format csv -o load.csv
+
+50k jobs need a matching `ulimit -u` and kernel.pid_max, a size that can't be reached is
+reported with the number of jobs that did start.
+"""
+
+import argparse
+import csv
+import errno
+import json
+import os
+import pty
+import re
+import select
+import signal
+import statistics
+import sys
+import termios
+import time
+
+PROMPT = b"@@LOAD@@> "
+SLEEP_SECS = 1000000
+SETTLE_SECS = 0.05  # fg prints the job before it waits for it, a key sent right away can miss it
+JOB_LINE = re.compile(rb"^\[(\d+)\] .* : (\d+) ", re.M)
+
+
+class Shell:
+    """a smash on a pty without echo, driven one command at a time"""
+
+    def __init__(self, binary):
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            attrs = termios.tcgetattr(0)
+            attrs[3] &= ~termios.ECHO
+            termios.tcsetattr(0, termios.TCSANOW, attrs)
+            os.execv(binary, [binary])
+        os.set_blocking(self.fd, False)
+        self.pending = b""
+        self.until(b"smash> ")
+        self.run(["chprompt " + PROMPT[:-2].decode()])
+
+    def read(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if not ready:
+            return b""
+        try:
+            return os.read(self.fd, 1 << 16)
+        except OSError as e:
+            if e.errno == errno.EIO:  # the shell is gone
+                raise EOFError
+            raise
+
+    def until(self, marker, count=1, timeout=600):
+        """reads until marker was seen count times, returns the output before the last one"""
+        deadline = time.monotonic() + timeout
+        seen = 0
+        out = []
+        while True:
+            idx = self.pending.find(marker)
+            if idx != -1:
+                out.append(self.pending[:idx])
+                self.pending = self.pending[idx + len(marker):]
+                seen += 1
+                if seen == count:
+                    return b"".join(out)
+                continue
+            if time.monotonic() > deadline:
+                raise TimeoutError("no %r from smash" % marker)
+            self.pending += self.read(1)
+
+    def send(self, data):
+        while data:
+            try:
+                written = os.write(self.fd, data)
+                data = data[written:]
+            except BlockingIOError:  # the shell is busy, take its output meanwhile
+                self.pending += self.read(0.01)
+
+    def run(self, lines, prompt=PROMPT):
+        """sends the lines and waits for a prompt after each one, returns the output"""
+        self.send(b"".join(line.encode() + b"\n" for line in lines))
+        return self.until(prompt, len(lines))
+
+    def timed(self, line, marker=PROMPT, keys=None):
+        """seconds from sending line (or keys) to marker"""
+        start = time.monotonic()
+        self.send(keys if keys is not None else line.encode() + b"\n")
+        self.until(marker, timeout=60)
+        return time.monotonic() - start
+
+    def key(self, keys):
+        """seconds from a ctrl key on the foreground job to the prompt"""
+        time.sleep(SETTLE_SECS)
+        return self.timed(None, keys=keys)
+
+    def close(self, pids):
+        try:
+            self.send(b"quit kill\n")
+            deadline = time.monotonic() + 60
+            while time.monotonic() < deadline and os.waitpid(self.pid, os.WNOHANG) == (0, 0):
+                try:
+                    self.read(0.1)
+                except EOFError:
+                    pass
+        except (OSError, EOFError):
+            pass
+        for pid in pids + [self.pid]:  # whatever quit didn't get to
+            try:
+                os.kill(pid, signal.SIGKILL)
+            except OSError:
+                pass
+        try:
+            os.waitpid(self.pid, 0)
+        except ChildProcessError:
+            pass
+        os.close(self.fd)
+
+
+def summary(samples):
+    ms = [s * 1000 for s in samples]
+    return {"median_ms": round(statistics.median(ms), 3), "min_ms": round(min(ms), 3),
+            "max_ms": round(max(ms), 3), "samples": len(ms)}
+
+
+def measure(binary, count, repeat, batch):
+    shell = Shell(binary)
+    pids = []
+    try:
+        start = time.monotonic()
+        for first in range(0, count, batch):
+            shell.run(["sleep %d &" % SLEEP_SECS] * min(batch, count - first))
+        launch = time.monotonic() - start
+        listing = shell.run(["jobs"])
+        jobs = [(int(job_id), int(pid)) for job_id, pid in JOB_LINE.findall(listing)]
+        pids = [pid for _, pid in jobs]
+        result = {"jobs": count, "started": len(jobs), "launch_secs": round(launch, 3)}
+        if len(jobs) < repeat * 2:
+            result["error"] = "too few jobs started to measure"
+            return result
+        times = {name: [] for name in ("prompt", "jobs", "kill", "fg", "ctrl_z", "bg", "ctrl_c")}
+        middle = len(jobs) // 2
+        for r in range(repeat):
+            times["prompt"].append(shell.timed(""))
+            times["jobs"].append(shell.timed("jobs"))
+            job_id = jobs[middle + r][0]
+            times["kill"].append(shell.timed("kill -18 %d" % job_id))
+            times["fg"].append(shell.timed("fg %d" % job_id, marker=b"\n"))
+            times["ctrl_z"].append(shell.key(b"\x1a"))
+            times["bg"].append(shell.timed("bg %d" % job_id))
+            victim = jobs[middle - r - 1][0]  # a different job each time, ctrl-C ends it
+            shell.timed("fg %d" % victim, marker=b"\n")
+            times["ctrl_c"].append(shell.key(b"\x03"))
+        result["metrics"] = {name: summary(samples) for name, samples in times.items()}
+        return result
+    finally:
+        shell.close(pids)
+
+
+def write_csv(results, out):
+    writer = csv.writer(out)
+    writer.writerow(["jobs", "started", "metric", "median_ms", "min_ms", "max_ms", "samples"])
+    for res in results:
+        writer.writerow([res["jobs"], res["started"], "launch", round(res["launch_secs"] * 1000, 3), "", "", 1])
+        for name, stats in res.get("metrics", {}).items():
+            writer.writerow([res["jobs"], res["started"], name, stats["median_ms"], stats["min_ms"],
+                             stats["max_ms"], stats["samples"]])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="smash job control load test")
+    parser.add_argument("binary", help="the smash binary")
+    parser.add_argument("--counts", default="1000,10000,50000", help="jobs list sizes, comma separated")
+    parser.add_argument("--repeat", type=int, default=5, help="samples per metric and size")
+    parser.add_argument("--batch", type=int, default=500, help="sleep jobs started per write")
+    parser.add_argument("--format", choices=("json", "csv"), default="json")
+    parser.add_argument("-o", "--output", help="report file, stdout by default")
+    args = parser.parse_args()
+
+    binary = os.path.abspath(args.binary)
+    results = []
+    for count in (int(c) for c in args.counts.split(",")):
+        print("smash load: %d jobs" % count, file=sys.stderr)
+        results.append(measure(binary, count, args.repeat, args.batch))
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    if args.format == "json":
+        json.dump({"binary": binary, "results": results}, out, indent=2)
+        out.write("\n")
+    else:
+        write_csv(results, out)
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
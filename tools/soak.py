@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+Memory soak test for smash.
+
+Pipes a long stream of commands (10M by default) into one smash and samples its VmRSS from
+/proc/<pid>/status as it goes. Most commands are builtins, which run inside smash and are where
+a leaked Command, argument or path would pile up: command lists, variables, here-docs and
+pending `after` jobs among them. Every --external-every commands something that forks goes
+through as well, a background job, a captured one or a sleep the `after` lines wait on, so jobs
+list entries and capture rings are created and freed.
+
+Before each sample an `echo` marker is sent, and the sample is taken once smash has printed it,
+so RSS is read after smash ran everything before it and not while it is still behind.
+
+    g++ -std=c++11 -O2 -o smash *.cpp
+    tools/soak.py ./smash                            # samples as CSV on stdout, verdict on stderr
+    tools/soak.py ./smash --count 1000000 -o rss.csv
+
+RSS is compared between the end of the warm-up (--warmup, a fraction of the run) and the last
+sample. the exit status is 1 when it grew by more than --max-growth-kb.
+"""
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+import threading
+import time
+
+BUILTINS = [
+    "pwd",
+    "showpid",
+    "jobs",
+    "cd .",
+    "cd -",
+    "chprompt soak",
+    "chprompt",
+    "fg 2",  # an error path: job 2 is a pending `after` job or not listed
+    "kill -9 2",
+    "pwd && showpid",
+    "cd /nonexistent || pwd",
+    "jobs ; pwd",
+    "export SOAK=soak",
+    "chprompt $SOAK",
+    "unset SOAK",
+    "wc -c <<< soak",
+    "wc -l <<SOAK\nsoak\nSOAK",
+    "after 1 -- pwd",  # pending while the sleep below is job 1, an error path otherwise
+    "after --ok 1 -- showpid",
+    "output 1",  # prints and drops a finished capture, jobs above drops the rest
+]
+EXTERNAL = ["true", "true &", "capture -s 4096 echo soak &", "sleep 0.05 &"]
+MARKER = re.compile(rb"@@SOAK (\d+)@@")
+
+
+class Output(threading.Thread):
+    """drains smash's stdout so it never blocks on it, and keeps the last marker seen"""
+
+    def __init__(self, stream):
+        super().__init__(daemon=True)
+        self.stream = stream
+        self.marker = -1
+        self.seen = threading.Condition()
+
+    def run(self):
+        tail = b""
+        while True:
+            chunk = self.stream.read1(1 << 16)
+            if not chunk:
+                break
+            tail += chunk
+            found = [int(m) for m in MARKER.findall(tail)]
+            tail = tail[-32:]  # a marker cut between two reads
+            if found:
+                with self.seen:
+                    self.marker = max(found[-1], self.marker)
+                    self.seen.notify_all()
+        with self.seen:
+            self.marker = None  # smash is gone
+            self.seen.notify_all()
+
+    def wait_for(self, marker, timeout=600):
+        with self.seen:
+            if not self.seen.wait_for(lambda: self.marker is None or self.marker >= marker, timeout):
+                raise TimeoutError("smash didn't echo marker %d" % marker)
+            if self.marker is None:
+                raise BrokenPipeError
+
+
+def vm_rss_kb(pid):
+    with open("/proc/%d/status" % pid) as status:
+        for line in status:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    raise RuntimeError("no VmRSS for pid %d" % pid)
+
+
+def commands(count, external_every, block_size):
+    """yields blocks of commands, count in all"""
+    block = []
+    for i in range(count):
+        if external_every and i % external_every == external_every - 1:
+            block.append(EXTERNAL[(i // external_every) % len(EXTERNAL)])
+        else:
+            block.append(BUILTINS[i % len(BUILTINS)])
+        if len(block) == block_size:
+            yield block
+            block = []
+    if block:
+        yield block
+
+
+def main():
+    parser = argparse.ArgumentParser(description="smash memory soak test")
+    parser.add_argument("binary", help="the smash binary")
+    parser.add_argument("--count", type=int, default=10000000, help="commands to run")
+    parser.add_argument("--samples", type=int, default=200, help="VmRSS samples over the run")
+    parser.add_argument("--external-every", type=int, default=1000, help="0 runs builtins only")
+    parser.add_argument("--warmup", type=float, default=0.1, help="part of the run before the baseline sample")
+    parser.add_argument("--max-growth-kb", type=int, default=512, help="allowed RSS growth after the warm-up")
+    parser.add_argument("-o", "--output", help="samples as CSV, stdout by default")
+    args = parser.parse_args()
+
+    smash = subprocess.Popen([os.path.abspath(args.binary)], stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    output = Output(smash.stdout)
+    output.start()
+    every = max(1, args.count // args.samples)
+    samples = []
+    sent = 0
+    next_sample = every
+    start = time.monotonic()
+
+    def sample():
+        smash.stdin.write(b"echo @@SOAK %d@@\n" % sent)
+        smash.stdin.flush()
+        output.wait_for(sent)
+        samples.append((sent, round(time.monotonic() - start, 3), vm_rss_kb(smash.pid)))
+
+    try:
+        for block in commands(args.count, args.external_every, min(4096, every)):
+            smash.stdin.write(("\n".join(block) + "\n").encode())
+            sent += len(block)
+            if sent >= next_sample:
+                sample()
+                next_sample += every
+        if not samples or samples[-1][0] != sent:
+            sample()
+        smash.stdin.write(b"quit kill\n")
+        smash.stdin.close()
+    except (BrokenPipeError, TimeoutError) as e:
+        print("soak: smash exited or stalled after %d commands (%s)" % (sent, e), file=sys.stderr)
+        return 2
+    finally:
+        try:
+            smash.wait(timeout=60)
+        except subprocess.TimeoutExpired:
+            smash.kill()
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    writer = csv.writer(out)
+    writer.writerow(["commands", "secs", "vm_rss_kb"])
+    writer.writerows(samples)
+    if out is not sys.stdout:
+        out.close()
+
+    baseline = next(s for s in samples if s[0] >= args.count * args.warmup)
+    growth = samples[-1][2] - baseline[2]
+    print("soak: %d commands in %.1fs, VmRSS %d kB after warm-up, %d kB at the end (%+d kB)"
+          % (sent, samples[-1][1], baseline[2], samples[-1][2], growth), file=sys.stderr)
+    if growth > args.max_growth_kb:
+        print("soak: RSS grew by more than %d kB" % args.max_growth_kb, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())